@@ -50,7 +50,8 @@ def _export_bmesh_by_material(registry: SceneRegistry, me) -> list[(str, str)]:
 
         # Make sure all faces are convex
         bmesh.ops.connect_verts_concave(bm, faces=bm.faces)
-        bmesh.ops.triangulate(bm, faces=bm.faces)
+        # Quads are supported natively, only larger polygons need to be split
+        bmesh.ops.triangulate(bm, faces=[f for f in bm.faces if len(f.verts) > 4])
 
         bm.normal_update()
 
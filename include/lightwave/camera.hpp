@@ -60,6 +60,12 @@ public:
      * @param rng A random number generator used to steer the sampling.
      */
     virtual CameraSample sample(const Point2 &normalized, Sampler &rng) const = 0;
+
+    /**
+     * @brief Returns whether rays of neighbouring pixels are coherent (e.g., share their origin, as for pinhole
+     * cameras), in which case camera rays are traced in packets.
+     */
+    virtual bool hasCoherentRays() const { return false; }
 };
 
 }
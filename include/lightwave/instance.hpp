@@ -26,14 +26,30 @@ class Instance : public Shape {
     ref<Shape> m_shape;
     /// @brief The material that the shape should be rendered with (can be null for non-reflecting objects).
     ref<Bsdf> m_bsdf;
+    /**
+     * @brief All materials of the instance, for shapes that assign materials to their primitives (see
+     * @ref Intersection::materialIndex ). The first one is @c m_bsdf .
+     */
+    std::vector<ref<Bsdf>> m_bsdfs;
     /// @brief The distribution of light the shape should emit (can be null for non-emissive objects).
     ref<Emission> m_emission;
     /// @brief The transformation applied to the shape, leading from object coordinates to world coordinates.
     ref<Transform> m_transform;
+    /**
+     * @brief The transformations of all frames of an animation (if more than one transform is specified).
+     * Frame @c i uses the @c i -th transform, frames past the end keep the last transform.
+     */
+    std::vector<ref<Transform>> m_keyframes;
+    /// @brief The animation frame the instance is currently set to.
+    int m_frame;
+    /// @brief Whether the instance changed when switching to the current frame.
+    bool m_frameChanged;
     /// @brief Flip the normal direction, used to correct for the change of handedness in case the transformation mirrors the object.
     bool m_flipNormal;
     /// @brief Tracks whether this instance has been added to the scene, i.e., could be hit by ray tracing.
     bool m_visible;
+    /// @brief The kinds of rays that can hit the instance (see @ref RayType ).
+    uint8_t m_visibility;
     
     /// @brief The texture for the normal mapping
     ref<Texture> m_normalMap;
@@ -49,13 +65,22 @@ public:
     Instance(const Properties &properties) 
         : m_light(nullptr) {
         m_shape = properties.getChild<Shape>();
-        m_bsdf = properties.getOptionalChild<Bsdf>();
+        m_bsdfs = properties.getChildren<Bsdf>();
+        m_bsdf = m_bsdfs.empty() ? nullptr : m_bsdfs.front();
         m_emission = properties.getOptionalChild<Emission>();
-        m_transform = properties.getOptionalChild<Transform>();
+        m_keyframes = properties.getChildren<Transform>();
+        m_transform = m_keyframes.empty() ? nullptr : m_keyframes.front();
         m_normalMap = properties.get<Texture>("normal", nullptr);
         m_alpha_mask = properties.get<Texture>("alpha", nullptr);
         m_medium = properties.getOptionalChild<Medium>();
+        m_shape->attachAlphaMask(m_alpha_mask.get());
+        m_visibility = 0;
+        if (properties.get<bool>("visibleToCamera", true)) m_visibility |= CameraRay;
+        if (properties.get<bool>("castsShadows", true)) m_visibility |= ShadowRay;
+        if (properties.get<bool>("visibleToIndirect", true)) m_visibility |= IndirectRay;
         m_visible = false;
+        m_frame = 0;
+        m_frameChanged = false;
 
         m_flipNormal = false;
         if (m_transform && m_transform->determinant() < 0) {
@@ -65,10 +90,30 @@ public:
 
     /// @brief Returns the material that the shape should be rendered with (can be null for non-reflecting objects).
     Bsdf *bsdf() const { return m_bsdf.get(); }
+    /**
+     * @brief Returns the material with the given index among the materials of the instance (in the order they are
+     * specified), where indices past the end refer to the last material.
+     */
+    Bsdf *bsdf(int materialIndex) const {
+        if (materialIndex == 0 || m_bsdfs.empty()) return m_bsdf.get();
+        return m_bsdfs[std::min(materialIndex, int(m_bsdfs.size()) - 1)].get();
+    }
     /// @brief Returns the distribution of light the shape should emit (can be null for non-emissive objects).
     Emission *emission() const { return m_emission.get(); }
     /// @brief Returns the light object that contains this instance (or null if this instance is not part of any area light).
     Light *light() const { return m_light; }
+    /// @brief Returns the shape wrapped by the instance.
+    Shape *shape() const { return m_shape.get(); }
+    /// @brief Returns the transformation applied to the shape (or null if the shape is not transformed).
+    Transform *transform() const { return m_transform.get(); }
+    /// @brief Returns the texture used for alpha masking (or null for opaque instances).
+    Texture *alphaMask() const { return m_alpha_mask.get(); }
+    /// @brief Returns whether the instance is filled with a medium, in which case it is not a plain transformed shape.
+    bool hasMedium() const { return m_medium != nullptr; }
+
+    /// @brief Returns the kinds of rays that can hit the instance, as set by its @c visibleToCamera , @c castsShadows
+    /// and @c visibleToIndirect properties (and limited to those that can hit the wrapped shape).
+    uint8_t visibility() const override { return m_visibility & m_shape->visibility(); }
 
     /// @brief Returns whether this instance has been added to the scene, i.e., could be hit by ray tracing.
     bool isVisible() const { return m_visible; }
@@ -77,6 +122,10 @@ public:
         m_visible = true;
     }
 
+    void forEachChild(const std::function<void (const Shape &)> &function) const override {
+        function(*m_shape);
+    }
+
     /// @brief Sets the parent light object that contains this instance.
     void setLight(Light *light) {
         if (m_light) {
@@ -93,6 +142,45 @@ public:
      * @return @c true if an intersection was found.
      */
     bool intersect(const Ray &ray, Intersection &its, Sampler &rng) const override;
+    /**
+     * @brief Intersects the instance with a packet of rays in world coordinates, which are transformed together and
+     * handed to the wrapped shape as a packet.
+     * @note Instances with a medium intersect the rays one by one.
+     */
+    RayMask intersectPacket(const Ray *rays, Intersection *its, Sampler *const *rngs, RayMask active) const override;
+    /**
+     * @brief Tests whether the instance blocks a given ray in world coordinates, without populating the hit.
+     * @note Instances with a medium fall back to @ref intersect , as whether they block the ray is a random decision
+     * that depends on the distance the ray travels within the medium.
+     */
+    bool occluded(const Ray &ray, Intersection &its, Sampler &rng) const override;
+    /**
+     * @brief Completes a hit of the wrapped shape that has been found in object coordinates, by populating the instance
+     * field and transforming the hit to world coordinates.
+     * If the wrapped shape has deferred the surface attributes (see @ref Intersection::deferredShape ), only the instance
+     * field is populated, and the transform is applied by @ref Intersection::populateDeferred .
+     * @note Rescaling @c its.t is left to the caller, which has transformed the ray.
+     */
+    void completeIntersection(Intersection &its) const;
+    /**
+     * @brief Completes a shadow ray hit of the wrapped shape, by recording the instance as part of
+     * @c its.occluder (see @ref Intersection::occluder ).
+     * @note Occluders within nested instances are discarded, as @ref occludedBy only applies a single transform.
+     */
+    void completeOcclusion(Intersection &its) const {
+        if (its.occluder.instance) {
+            its.occluder = {};
+        } else {
+            its.occluder.instance = this;
+        }
+    }
+    /**
+     * @brief Tests whether an occluder within the wrapped shape (see @ref completeOcclusion ) blocks a given ray in
+     * world coordinates.
+     */
+    bool occludedBy(const Occluder &occluder, const Ray &ray, Intersection &its, Sampler &rng) const;
+    /// @brief Switches to the transform of the given frame (if animated), and updates the wrapped shape.
+    bool setFrame(int frame) override;
     /// @brief Returns the bounding box of the instance in world coordinates. 
     Bounds getBoundingBox() const override;
     /// @brief Returns the centroid of the instance in world coordinates. 
@@ -37,6 +37,18 @@ protected:
     ref<Image> m_image;
     /// @brief The scene that should be rendered.
     ref<Scene> m_scene;
+    /// @brief Whether to trace camera rays in packets of 8x8 pixels (if the camera and integrator support it).
+    bool m_packets;
+
+    /// @brief Renders the pixels of a block by tracing one ray at a time.
+    void renderBlock(const Bounds2i &block, Sampler &sampler);
+    /**
+     * @brief Renders the pixels of a block by handing all camera rays of a sample to @ref primaryLiBatch at once.
+     * @param samplers The random number generators of the rays, which are cloned from @c m_sampler as needed and can
+     * be reused for further blocks.
+     * @param packets Whether to trace the camera rays of 8x8 pixels at a time as packet.
+     */
+    void renderBlockBatched(const Bounds2i &block, std::vector<ref<Sampler>> &samplers, bool packets);
 
 public:
     SamplingIntegrator(const Properties &properties)
@@ -44,6 +56,7 @@ public:
         m_sampler = properties.getChild<Sampler>();
         m_image = properties.getOptionalChild<Image>();
         m_scene = properties.getChild<Scene>();
+        m_packets = properties.get<bool>("packets", true);
     }
 
     /// @brief Sets the output image that should be populated by rendering.
@@ -66,6 +79,32 @@ public:
      * @ref execute function of the integrator.
      */
     virtual Color Li(const Ray &ray, Sampler &rng) = 0;
+
+    /**
+     * @brief Returns (an estimate of) the incident radiance for a camera ray whose closest hit @c its has already been
+     * found, which allows tracing camera rays in packets (see @ref usesPrimaryHits ).
+     */
+    virtual Color primaryLi(const Ray &ray, const Intersection &its, Sampler &rng) {
+        NOT_IMPLEMENTED
+    }
+    /**
+     * @brief Computes @ref primaryLi for all camera rays of a block at once, which integrators can override to trace
+     * the remainder of their paths together (e.g., to reorder secondary rays for coherence).
+     * @note Every ray comes with its own random number generator, which must be used for that ray only.
+     */
+    virtual void primaryLiBatch(int count, const Ray *rays, const Intersection *its, Sampler *const *rngs,
+                                Color *results) {
+        for (int i = 0; i < count; i++) {
+            results[i] = primaryLi(rays[i], its[i], *rngs[i]);
+        }
+    }
+    /// @brief Returns whether the integrator implements @ref primaryLi , and thus @ref Li starts by intersecting the ray.
+    virtual bool usesPrimaryHits() const { return false; }
+    /**
+     * @brief Returns whether @ref primaryLiBatch traces the paths of a block together, in which case camera rays are
+     * batched even if they are not traced in packets.
+     */
+    virtual bool tracesPathsTogether() const { return false; }
 };
 
 }
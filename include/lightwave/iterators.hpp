@@ -72,7 +72,7 @@ public:
     ChunkedRange(int count, int blockSize)
     : ChunkedRange(0, count, blockSize) {}
 
-    iterator begin() const { return iterator(m_start, m_start + m_blockSize, m_end); }
+    iterator begin() const { return iterator(m_start, std::min(m_start + m_blockSize, m_end), m_end); }
     iterator end() const { return iterator(m_end, m_end, m_end); }
 
 private:
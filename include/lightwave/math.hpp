@@ -546,6 +546,8 @@ using Vector = TVector<float, 3>;
 using Vector3i = TVector<int, 3>;
 /// @brief A four-dimensional vector with floating point components (used for homogeneous coordinates).
 using Vector4 = TVector<float, 4>;
+/// @brief A four-dimensional vector with integer components.
+using Vector4i = TVector<int, 4>;
 
 /// @brief An integer rectangle (e.g., to describe the blocks of an image).
 using Bounds2i = TBounds<int, 2>;
@@ -739,6 +741,31 @@ struct SurfaceEvent {
     const Instance *instance = nullptr;
 };
 
+/**
+ * @brief The kinds of rays that are traced, as bits of the masks that control which rays can hit an object (see
+ * @ref Shape::visibility ).
+ */
+enum RayType : uint8_t {
+    /// @brief Rays from the camera (i.e., rays with @c depth 0).
+    CameraRay = 1 << 0,
+    /// @brief Rays that test the visibility of light sources.
+    ShadowRay = 1 << 1,
+    /// @brief Rays of all further bounces.
+    IndirectRay = 1 << 2,
+};
+/// @brief The visibility mask of objects that can be hit by all kinds of rays.
+static constexpr uint8_t AllRayTypes = CameraRay | ShadowRay | IndirectRay;
+
+/// @brief A single primitive that has blocked a shadow ray, which can be tested again for the following shadow rays.
+struct Occluder {
+    /// @brief The instance that wraps @c shape (or null if the shape is not instanced).
+    const Instance *instance = nullptr;
+    /// @brief The shape that contains the primitive (see @ref Shape::occludedPrimitive ), or null for no occluder.
+    const Shape *shape = nullptr;
+    /// @brief The primitive of @c shape that has blocked the ray.
+    int primitiveIndex = 0;
+};
+
 /// @brief Describes an intersection of a ray with a surface.
 struct Intersection : public SurfaceEvent {
     /// @brief The direction of the ray that hit the surface, pointing away from the surface.
@@ -747,6 +774,30 @@ struct Intersection : public SurfaceEvent {
     float t;
     /// @brief The alpha masked, which can be used to check if an intersection should occur
     Texture *alpha_mask = nullptr;
+    /// @brief The kind of ray that is traced, which decides which objects it can hit (see @ref Shape::visibility ).
+    RayType rayType = IndirectRay;
+    /**
+     * @brief For shadow rays: The primitive that has blocked the ray, if it blocks every ray that reaches it (e.g.,
+     * is not alpha masked), or an empty occluder otherwise (see @ref Scene::intersect ).
+     */
+    Occluder occluder;
+
+    /**
+     * @brief The shape whose hit has only been recorded (as @c primitiveIndex and @c barycentrics ), but whose surface
+     * attributes (position, uv and frame) have not been computed yet, or null if the surface attributes are up to date.
+     * Computing attributes during traversal is mostly wasted, as closer hits keep replacing them, hence shapes may
+     * defer this until the closest hit is known (see @ref populateDeferred ).
+     */
+    const Shape *deferredShape = nullptr;
+    /// @brief The primitive of @c deferredShape that has been hit.
+    int primitiveIndex;
+    /// @brief The barycentric coordinates of the hit within the primitive of @c deferredShape .
+    Vector2 barycentrics;
+    /**
+     * @brief The index of the material of the hit among the materials of @c instance (see @ref Instance::bsdf ), for
+     * shapes whose primitives have different materials. Such shapes set it when the hit is populated.
+     */
+    int materialIndex = 0;
 
     /// @brief Statistics recorded while traversing acceleration structures.
     struct {
@@ -767,6 +818,12 @@ struct Intersection : public SurfaceEvent {
         return instance != nullptr;
     }
 
+    /**
+     * @brief Computes the surface attributes of a deferred hit (if any), in object coordinates of @c deferredShape and
+     * then transformed by @c instance (if set).
+     */
+    void populateDeferred();
+
     /// @brief Evaluates the emission of the underlying instance.
     Color evaluateEmission() const;
     /// @brief Samples the Bsdf of the underlying surface.
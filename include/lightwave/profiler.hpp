@@ -2,6 +2,7 @@
 
 #include <lightwave/logger.hpp>
 #include <map>
+#include <vector>
 #include <tinyformat.h>
 
 #if defined(__aarch64__)
@@ -31,6 +31,18 @@ class Scene : public Object {
      * @note Emissive objects will only be part of this list if explicitly requested (i.e., an AreaLight has been created for them).
      */
     std::vector<ref<Light>> m_lights;
+    /**
+     * @brief Whether every thread remembers the primitive that has last blocked a shadow ray towards each light, and
+     * tests it first for the next shadow ray towards that light.
+     */
+    bool m_occluderCache;
+    /// @brief Distinguishes the entries of the occluder cache from those of previously loaded scenes.
+    uint64_t m_occluderCacheKey;
+    /**
+     * @brief Whether intersecting the geometry consumes random numbers (for alpha masks or media), in which case the
+     * results depend on the order in which shapes are visited, and packets of rays are traced one ray at a time.
+     */
+    bool m_hasStochasticShapes;
 
 public:
     Scene(const Properties &properties);
@@ -38,11 +50,24 @@ public:
 
     /// @brief The camera from which the image is to be rendered.
     Camera *camera() const { return m_camera.get(); }
+    /// @brief The geometry of the scene.
+    const Shape *shape() const { return m_shape.get(); }
     
-    /// @brief Finds the closest intersection of the scene for a given ray.
+    /// @brief Finds the closest intersection of the scene for a given ray (a camera ray if its depth is 0).
     Intersection intersect(const Ray &ray, Sampler &rng) const;
-    /// @brief Reports whether any intersection up to a given maximal distance exists (used for testing visibility of light sources).
-    bool intersect(const Ray &ray, float tMax, Sampler &rng) const;
+    /**
+     * @brief Reports whether any intersection up to a given maximal distance exists (used for testing visibility of light sources).
+     * @param light The light the ray is traced towards (if any), whose last occluder is tested first if the occluder
+     * cache is enabled.
+     */
+    bool intersect(const Ray &ray, float tMax, Sampler &rng, const Light *light = nullptr) const;
+    /**
+     * @brief Finds the closest intersections of a packet of (ideally coherent) rays at once, with the same results as
+     * calling @ref intersect for each of them.
+     * @param count The number of rays (at most @ref MaxPacketSize ).
+     * @param rngs The random number generator of each ray.
+     */
+    void intersect(int count, const Ray *rays, Intersection *its, Sampler *const *rngs) const;
     /// @brief Evaluates the background illumination for a given direction pointing away from the scene.
     BackgroundLightEval evaluateBackground(const Vector &direction) const;
 
@@ -56,6 +81,12 @@ public:
     float lightSelectionProbability(const Light *light) const;
     /// @brief Returns the bounding box of the scene geometry.
     Bounds getBoundingBox() const;
+
+    /**
+     * @brief Updates the scene geometry to the given frame of an animation (see @ref Shape::setFrame ).
+     * @return Whether the geometry has changed.
+     */
+    bool setFrame(int frame);
 };
 
 }
@@ -16,6 +16,9 @@
 #include <lightwave/texture.hpp>
 #include <lightwave/transform.hpp>
 
+#include <bit>
+#include <functional>
+
 namespace lightwave {
 
 /// @brief The result of sampling a random point on a shape's surface via @ref Shape::sampleArea .
@@ -28,14 +31,72 @@ struct AreaSample : public SurfaceEvent {
     }
 };
 
+/// @brief A set of rays of a packet, as bitmask over their indices (see @ref Shape::intersectPacket ).
+typedef uint64_t RayMask;
+/// @brief The largest number of rays in a packet.
+static constexpr int MaxPacketSize = 64;
+
 /// @brief A shape represents a geometrical object that can be intersected by rays.
 class Shape : public Object {
 public:
     /**
      * @brief Tests the shape for intersection with a ray, and on success updates the provided Intersection object.
      * @note Intersections farther away than the previous value of @c its.t will be dismissed.
+     * @note Shapes can either populate the surface attributes of the hit right away (and then reset
+     * @c its.deferredShape to null), or only record the hit and defer the attributes to @ref populateIntersection
+     * (by setting @c its.deferredShape to themselves and @c its.instance to null).
      */
     virtual bool intersect(const Ray &ray, Intersection &its, Sampler &rng) const = 0;
+    /**
+     * @brief Tests whether the shape blocks the ray before @c its.t (used for shadow rays).
+     * Unlike @ref intersect , this may stop at the first hit that is found instead of the closest one, and does not
+     * need to populate the attributes of the hit.
+     * @note Besides @c its.t (which is only updated for the sake of consistency), the intersection should be treated
+     * as undefined after this call.
+     */
+    virtual bool occluded(const Ray &ray, Intersection &its, Sampler &rng) const {
+        return intersect(ray, its, rng);
+    }
+    /**
+     * @brief Tests whether a single primitive, which has been reported in @c its.occluder by @ref occluded , blocks the
+     * ray before @c its.t . This is much cheaper than @ref occluded when the same primitive blocks many shadow rays.
+     */
+    virtual bool occludedPrimitive(int primitiveIndex, const Ray &ray, Intersection &its, Sampler &rng) const {
+        return false;
+    }
+    /**
+     * @brief Computes the surface attributes (position, uv and frame) of a hit that has been deferred by
+     * @ref intersect , from @c its.primitiveIndex and @c its.barycentrics .
+     */
+    virtual void populateIntersection(Intersection &its) const {}
+    /**
+     * @brief Tests the shape for intersection with a packet of rays (e.g., neighbouring camera rays), which has the
+     * same result as calling @ref intersect for each of them. Shapes with acceleration structures override this to
+     * traverse them once for all rays.
+     * @param rays The rays of the packet (at most @ref MaxPacketSize ), each of which comes with its own intersection
+     * and random number generator.
+     * @param active The rays to test.
+     * @return The rays that have hit the shape.
+     */
+    virtual RayMask intersectPacket(const Ray *rays, Intersection *its, Sampler *const *rngs, RayMask active) const {
+        RayMask hits = 0;
+        for (; active; active &= active - 1) {
+            const int index = std::countr_zero(active);
+            if (intersect(rays[index], its[index], *rngs[index])) {
+                hits |= RayMask(1) << index;
+            }
+        }
+        return hits;
+    }
+    /**
+     * @brief Returns the kinds of rays that can hit the shape (see @ref RayType ), e.g., to skip objects that do not
+     * cast shadows when tracing shadow rays.
+     * @note Shapes composed of other shapes report the union over their children, so that acceleration structures can
+     * skip entire subtrees.
+     */
+    virtual uint8_t visibility() const {
+        return AllRayTypes;
+    }
     /// @brief Returns a bounding box that tightly encapsulates the shape. 
     virtual Bounds getBoundingBox() const = 0;
     /**
@@ -56,6 +117,25 @@ public:
      * using a reference.
      */
     virtual void markAsVisible() {}
+
+    /**
+     * @brief Updates the shape to the given frame of an animation (e.g., by switching transforms or loading deformed
+     * vertices), and returns whether its geometry has changed.
+     * @note Shapes can be referenced multiple times, hence this can be called multiple times for the same frame, and
+     * every call must report the same result.
+     */
+    virtual bool setFrame(int frame) {
+        return false;
+    }
+
+    /**
+     * @brief Called by every instance that wraps this shape with the alpha mask of the instance (or null), which allows
+     * shapes to prepare for the alpha mask while loading (e.g., by classifying which primitives are opaque).
+     */
+    virtual void attachAlphaMask(const Texture *alphaMask) {}
+
+    /// @brief Calls the given function for every shape this shape is composed of (e.g., the children of a group).
+    virtual void forEachChild(const std::function<void (const Shape &)> &function) const {}
 };
 
 }
@@ -30,6 +30,14 @@ public:
         // we would ideally have a separate texture interface for scalar values)
         return evaluate(uv).r();
     }
+    /**
+     * @brief Computes conservative bounds of the red channel of @ref evaluate over a triangle in texture space, which
+     * allows classifying alpha masks ahead of time (e.g., triangles that are fully opaque).
+     * @return Whether bounds could be determined (by default, nothing is known about the texture).
+     */
+    virtual bool redRange(const Point2 &a, const Point2 &b, const Point2 &c, float &min, float &max) const {
+        return false;
+    }
 };
 
 }
@@ -166,6 +166,11 @@ public:
         m_inverse = m_inverse * matrix;
     }
 
+    /// @brief Returns the inverse transform as matrix in homogeneous coordinates.
+    const Matrix4x4 &inverseMatrix() const {
+        return m_inverse;
+    }
+
     /// @brief Returns the determinant of this transformation. 
     float determinant() const {
         return m_transform.submatrix<3, 3>(0, 0).determinant();
@@ -72,6 +72,10 @@ public:
         };
     }
 
+    bool hasCoherentRays() const override {
+        return true;
+    }
+
     std::string toString() const override {
         return tfm::format(
             "Orthographic[\n"
@@ -71,6 +71,10 @@ public:
         };
     }
 
+    bool hasCoherentRays() const override {
+        return true;
+    }
+
     std::string toString() const override {
         return tfm::format(
             "Perspective[\n"
@@ -81,6 +81,9 @@ void populateVolumeIntersection(Intersection &its, Ray &ray, float new_t, Sample
 }
 
 bool Instance::intersect(const Ray &worldRay, Intersection &its, Sampler &rng) const {
+    if (!(m_visibility & its.rayType)) {
+        return false;
+    }
 
     const float previous_t = its.t;
     Ray localRay = !m_transform ? worldRay : m_transform->inverse(worldRay);
@@ -103,6 +106,8 @@ bool Instance::intersect(const Ray &worldRay, Intersection &its, Sampler &rng) c
         if (intersectionHappens == false) {
             return false;
         }
+        // the medium needs the surface attributes right away
+        its.populateDeferred();
 
         bool inside_volume = its.frame.normal.dot(localRay.direction) < 0 ? false : true;
 
@@ -149,7 +154,7 @@ bool Instance::intersect(const Ray &worldRay, Intersection &its, Sampler &rng) c
         // fast path, if no transform is needed
         Ray localRay = worldRay;
         if (m_shape->intersect(localRay, its, rng)) {
-            its.instance = this;
+            completeIntersection(its);
             return true;
         } else {
             return false;
@@ -162,8 +167,7 @@ bool Instance::intersect(const Ray &worldRay, Intersection &its, Sampler &rng) c
     if (wasIntersected) {
         // Transform its.t back to world space
         its.t = its.t / scaling;
-        its.instance = this;
-        transformFrame(its);
+        completeIntersection(its);
         return true;
     } else {
         // We got no intersection so we assign the previousT, which was already correct for world space
@@ -172,6 +176,140 @@ bool Instance::intersect(const Ray &worldRay, Intersection &its, Sampler &rng) c
     }
 }
 
+RayMask Instance::intersectPacket(const Ray *worldRays, Intersection *its, Sampler *const *rngs,
+                                  RayMask active) const {
+    for (RayMask remaining = active; remaining; remaining &= remaining - 1) {
+        const int i = std::countr_zero(remaining);
+        if (!(m_visibility & its[i].rayType)) {
+            active &= ~(RayMask(1) << i);
+        }
+    }
+    if (m_medium || !active) {
+        return Shape::intersectPacket(worldRays, its, rngs, active);
+    }
+
+    // same as in intersect, but for every ray of the packet
+    Ray localRays[MaxPacketSize];
+    float scalings[MaxPacketSize];
+    float previous_ts[MaxPacketSize];
+    for (RayMask remaining = active; remaining; remaining &= remaining - 1) {
+        const int i = std::countr_zero(remaining);
+        its[i].alpha_mask = m_alpha_mask.get();
+        previous_ts[i] = its[i].t;
+        if (!m_transform) {
+            localRays[i] = worldRays[i];
+            scalings[i] = 1;
+            continue;
+        }
+        localRays[i] = m_transform->inverse(worldRays[i]);
+        scalings[i] = localRays[i].direction.length();
+        localRays[i].direction = localRays[i].direction.normalized();
+        its[i].t = previous_ts[i] * scalings[i];
+    }
+
+    const RayMask hits = m_shape->intersectPacket(localRays, its, rngs, active);
+    for (RayMask remaining = active; remaining; remaining &= remaining - 1) {
+        const int i = std::countr_zero(remaining);
+        if (hits >> i & 1) {
+            if (m_transform) {
+                its[i].t = its[i].t / scalings[i];
+            }
+            completeIntersection(its[i]);
+        } else {
+            its[i].t = previous_ts[i];
+        }
+    }
+    return hits;
+}
+
+bool Instance::occluded(const Ray &worldRay, Intersection &its, Sampler &rng) const {
+    if (!(m_visibility & its.rayType)) {
+        return false;
+    }
+    if (m_medium) {
+        return intersect(worldRay, its, rng);
+    }
+
+    its.alpha_mask = m_alpha_mask.get();
+    if (!m_transform) {
+        // fast path, if no transform is needed
+        if (m_shape->occluded(worldRay, its, rng)) {
+            completeOcclusion(its);
+            return true;
+        }
+        return false;
+    }
+
+    // same as in intersect, but without transforming the frame of the hit
+    const float previous_t = its.t;
+    Ray localRay = m_transform->inverse(worldRay);
+    const float scaling = localRay.direction.length();
+    localRay.direction = localRay.direction.normalized();
+    its.t = previous_t * scaling;
+
+    if (m_shape->occluded(localRay, its, rng)) {
+        its.t = its.t / scaling;
+        completeOcclusion(its);
+        return true;
+    }
+    its.t = previous_t;
+    return false;
+}
+
+bool Instance::occludedBy(const Occluder &occluder, const Ray &worldRay, Intersection &its, Sampler &rng) const {
+    // same as in occluded, but only for a single primitive of the wrapped shape
+    its.alpha_mask = m_alpha_mask.get();
+    if (!m_transform) {
+        return occluder.shape->occludedPrimitive(occluder.primitiveIndex, worldRay, its, rng);
+    }
+
+    const float previous_t = its.t;
+    Ray localRay = m_transform->inverse(worldRay);
+    const float scaling = localRay.direction.length();
+    localRay.direction = localRay.direction.normalized();
+    its.t = previous_t * scaling;
+
+    if (occluder.shape->occludedPrimitive(occluder.primitiveIndex, localRay, its, rng)) {
+        its.t = its.t / scaling;
+        return true;
+    }
+    its.t = previous_t;
+    return false;
+}
+
+void Instance::completeIntersection(Intersection &its) const {
+    if (its.deferredShape && !its.instance) {
+        // the wrapped shape has only recorded the hit, which is transformed once it turns out to be the closest one
+        its.instance = this;
+        return;
+    }
+    // for nested instances, the hit of the inner instance needs to be completed first
+    its.populateDeferred();
+    its.instance = this;
+    if (m_transform) {
+        transformFrame(its);
+    }
+}
+
+bool Instance::setFrame(int frame) {
+    // instances can be shared, so only the first call per frame does work
+    if (frame == m_frame) {
+        return m_frameChanged;
+    }
+    m_frame = frame;
+
+    m_frameChanged = m_shape->setFrame(frame);
+    if (m_keyframes.size() > 1) {
+        const auto &keyframe = m_keyframes[std::clamp(frame, 0, int(m_keyframes.size()) - 1)];
+        if (keyframe != m_transform) {
+            m_transform = keyframe;
+            m_flipNormal = m_transform->determinant() < 0;
+            m_frameChanged = true;
+        }
+    }
+    return m_frameChanged;
+}
+
 Bounds Instance::getBoundingBox() const {
     if (!m_transform) {
         // fast path
@@ -179,6 +317,10 @@ Bounds Instance::getBoundingBox() const {
     }
 
     const Bounds untransformedAABB = m_shape->getBoundingBox();
+    if (untransformedAABB.min().x() > untransformedAABB.max().x()) {
+        // empty shapes (e.g., groups without children) stay empty, transforming their infinite corners would not
+        return untransformedAABB;
+    }
     if (untransformedAABB.isUnbounded()) {
         return Bounds::full();
     }
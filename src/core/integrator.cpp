@@ -1,15 +1,94 @@
 #include <lightwave/integrator.hpp>
 #include <lightwave/camera.hpp>
+#include <lightwave/shape.hpp>
 #include <lightwave/parallel.hpp>
 
 #include <algorithm>
 #include <chrono>
+#include <mutex>
 
 #include <lightwave/streaming.hpp>
 #include <lightwave/iterators.hpp>
 
 namespace lightwave {
 
+void SamplingIntegrator::renderBlock(const Bounds2i &block, Sampler &sampler) {
+    const float norm = 1.0f / m_sampler->samplesPerPixel();
+    for (auto pixel : block) {
+        Color sum;
+        for (int sample = 0; sample < m_sampler->samplesPerPixel(); sample++) {
+            sampler.seed(pixel, sample);
+            auto cameraSample = m_scene->camera()->sample(pixel, sampler);
+            sum += cameraSample.weight * Li(cameraSample.ray, sampler);
+        }
+        m_image->get(pixel) = norm * sum;
+    }
+}
+
+void SamplingIntegrator::renderBlockBatched(const Bounds2i &block, std::vector<ref<Sampler>> &samplers,
+                                            bool packets) {
+    // the rays of a packet come from a tile of PacketSize x PacketSize pixels
+    constexpr int PacketSize = 8;
+    static_assert(PacketSize * PacketSize <= MaxPacketSize);
+
+    // pixels are ordered tile by tile, so that the rays of every packet are stored consecutively
+    std::vector<Point2i> pixels;
+    std::vector<int> tileStarts;
+    for (int y = block.min().y(); y < block.max().y(); y += PacketSize) {
+        for (int x = block.min().x(); x < block.max().x(); x += PacketSize) {
+            tileStarts.push_back(int(pixels.size()));
+            for (auto pixel : block.clip(Bounds2i(Point2i(x, y), Point2i(x + PacketSize, y + PacketSize)))) {
+                pixels.push_back(pixel);
+            }
+        }
+    }
+    tileStarts.push_back(int(pixels.size()));
+    const int count = int(pixels.size());
+
+    // every ray needs its own sampler, seeded exactly like when tracing one ray at a time
+    while (int(samplers.size()) < count) {
+        samplers.push_back(m_sampler->clone());
+    }
+    std::vector<Sampler *> rngs(count);
+    for (int i = 0; i < count; i++) {
+        rngs[i] = samplers[i].get();
+    }
+
+    const float norm = 1.0f / m_sampler->samplesPerPixel();
+    std::vector<Color> sums(count, Color(0));
+    std::vector<Color> results(count);
+    std::vector<CameraSample> cameraSamples(count);
+    std::vector<Ray> rays(count);
+    std::vector<Intersection> its(count);
+    for (int sample = 0; sample < m_sampler->samplesPerPixel(); sample++) {
+        for (int i = 0; i < count; i++) {
+            rngs[i]->seed(pixels[i], sample);
+            cameraSamples[i] = m_scene->camera()->sample(pixels[i], *rngs[i]);
+            rays[i] = cameraSamples[i].ray;
+        }
+
+        if (packets) {
+            for (size_t tile = 0; tile + 1 < tileStarts.size(); tile++) {
+                const int start = tileStarts[tile];
+                m_scene->intersect(tileStarts[tile + 1] - start, &rays[start], &its[start], &rngs[start]);
+            }
+        } else {
+            for (int i = 0; i < count; i++) {
+                its[i] = m_scene->intersect(rays[i], *rngs[i]);
+            }
+        }
+
+        primaryLiBatch(count, rays.data(), its.data(), rngs.data(), results.data());
+        for (int i = 0; i < count; i++) {
+            sums[i] += cameraSamples[i].weight * results[i];
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        m_image->get(pixels[i]) = norm * sums[i];
+    }
+}
+
 void SamplingIntegrator::execute() {
     if (!m_image) {
         lightwave_throw("<integrator /> needs an <image /> child to render into!");
@@ -18,20 +97,32 @@ void SamplingIntegrator::execute() {
     const Vector2i resolution = m_scene->camera()->resolution();
     m_image->initialize(resolution);
 
-    const float norm = 1.0f / m_sampler->samplesPerPixel();
-    
+    const bool usePackets = m_packets && m_scene->camera()->hasCoherentRays();
+    // batching camera rays only pays off if they are traced in packets, or their paths are traced together
+    const bool useBatches = usesPrimaryHits() && (usePackets || tracesPathsTogether());
+
+    // the samplers of batched blocks are only cloned once per thread, and then handed on from block to block
+    std::mutex samplerLock;
+    std::vector<std::vector<ref<Sampler>>> idleSamplers;
+
     Streaming stream { *m_image };
     ProgressReporter progress { resolution.product() };
     for_each_parallel(BlockSpiral(resolution, Vector2i(64)), [&](auto block) {
-        auto sampler = m_sampler->clone();
-        for (auto pixel : block) {
-            Color sum;
-            for (int sample = 0; sample < m_sampler->samplesPerPixel(); sample++) {
-                sampler->seed(pixel, sample);
-                auto cameraSample = m_scene->camera()->sample(pixel, *sampler);
-                sum += cameraSample.weight * Li(cameraSample.ray, *sampler);
+        if (useBatches) {
+            std::vector<ref<Sampler>> samplers;
+            {
+                std::lock_guard lock(samplerLock);
+                if (!idleSamplers.empty()) {
+                    samplers = std::move(idleSamplers.back());
+                    idleSamplers.pop_back();
+                }
             }
-            m_image->get(pixel) = norm * sum;
+            renderBlockBatched(block, samplers, usePackets);
+            std::lock_guard lock(samplerLock);
+            idleSamplers.push_back(std::move(samplers));
+        } else {
+            auto sampler = m_sampler->clone();
+            renderBlock(block, *sampler);
         }
 
         progress += block.diagonal().product();
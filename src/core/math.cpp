@@ -141,6 +141,16 @@ void buildOrthonormalBasis(const Vector &a, Vector &b, Vector &c) {
     b = c.cross(a);
 }
 
+void Intersection::populateDeferred() {
+    if (!deferredShape) return;
+    materialIndex = 0;
+    deferredShape->populateIntersection(*this);
+    deferredShape = nullptr;
+    if (instance) {
+        instance->completeIntersection(*this);
+    }
+}
+
 Color Intersection::evaluateEmission() const {
     if (!instance->emission()) return Color::black();
     return instance->emission()->evaluate(uv, frame.toLocal(wo)).value;
@@ -149,12 +159,12 @@ Color Intersection::evaluateEmission() const {
 BsdfSample Intersection::sampleBsdf(Sampler &rng) const {
     PROFILE("Sample Bsdf")
 
-    if (!instance->bsdf()) return BsdfSample::invalid();
+    if (!instance->bsdf(materialIndex)) return BsdfSample::invalid();
     assert_normalized(wo, {});
-    auto bsdfSample = instance->bsdf()->sample(uv, frame.toLocal(wo), rng);
+    auto bsdfSample = instance->bsdf(materialIndex)->sample(uv, frame.toLocal(wo), rng);
     if (bsdfSample.isInvalid()) return bsdfSample;
     assert_normalized(bsdfSample.wi, {
-        logger(EError, "offending BSDF: %s", instance->bsdf()->toString());
+        logger(EError, "offending BSDF: %s", instance->bsdf(materialIndex)->toString());
         logger(EError, "  input was: %s with length %f", wo, wo.length());
     });
     bsdfSample.wi = frame.toWorld(bsdfSample.wi);
@@ -167,15 +177,15 @@ BsdfSample Intersection::sampleBsdf(Sampler &rng) const {
 BsdfEval Intersection::evaluateBsdf(const Vector &wi) const {
     PROFILE("Evaluate Bsdf")
 
-    if (!instance->bsdf())
+    if (!instance->bsdf(materialIndex))
         return BsdfEval::invalid();
-    return instance->bsdf()->evaluate(uv, frame.toLocal(wo), frame.toLocal(wi));
+    return instance->bsdf(materialIndex)->evaluate(uv, frame.toLocal(wo), frame.toLocal(wi));
 }
 
 BsdfEval Intersection::evaluateAlbedo() const {
-    if (!instance->bsdf())
+    if (!instance->bsdf(materialIndex))
         return BsdfEval::invalid();
-    return instance->bsdf()->evaluateAlbedo(uv);
+    return instance->bsdf(materialIndex)->evaluateAlbedo(uv);
 }
 
 }
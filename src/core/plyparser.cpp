@@ -1,7 +1,9 @@
 #include "plyparser.hpp"
 #include <lightwave/logger.hpp>
 
+#include <algorithm>
 #include <climits>
+#include <cstring>
 #include <fstream>
 
 namespace lightwave {
@@ -51,7 +53,8 @@ struct Header {
 static void readPlyContent(
     std::istream& stream, const Header& header, 
     std::vector<Vector3i> &indices,
-    std::vector<Vertex> &vertices
+    std::vector<Vertex> &vertices,
+    std::vector<Vector4i> *quads
 ) {
     const auto readFloat = [&]() {
         float val = 0;
@@ -122,8 +125,24 @@ static void readPlyContent(
 
     if (vertices.empty()) lightwave_throw("no vertices found");
 
-    indices.resize(header.FaceCount);
-    size_t indicesIndex = 0;
+    indices.clear();
+    indices.reserve(header.FaceCount);
+    if (quads) quads->clear();
+
+    const auto addFace = [&](uint32_t elems, const uint32_t *face) {
+        if (elems == 3) {
+            indices.push_back({ int(face[0]), int(face[1]), int(face[2]) });
+        } else if (quads) {
+            quads->push_back({ int(face[0]), int(face[1]), int(face[2]), int(face[3]) });
+        } else {
+            // split along the diagonal from the first to the third vertex
+            indices.push_back({ int(face[0]), int(face[1]), int(face[2]) });
+            indices.push_back({ int(face[0]), int(face[2]), int(face[3]) });
+        }
+    };
+
+    int facesIndex = 0;
+    uint32_t face[4];
 
     if (header.IsAscii) {
         for (int i = 0; i < header.FaceCount; ++i) {
@@ -135,27 +154,29 @@ static void readPlyContent(
 
             uint32_t elems = 0;
             sstream >> elems;
-            if (elems != 3) lightwave_throw("only triangles supported");
+            if (elems != 3 && elems != 4) lightwave_throw("only triangles and quads supported");
 
             for (uint32_t elem = 0; elem < elems; ++elem) {
-                sstream >> indices[indicesIndex][elem];
+                sstream >> face[elem];
             }
-            indicesIndex++;
+            addFace(elems, face);
+            facesIndex++;
         }
     } else {
         for (int i = 0; i < header.FaceCount; ++i) {
             uint8_t elems = 0;
             stream.read(reinterpret_cast<char*>(&elems), sizeof(elems));
-            if (elems != 3) lightwave_throw("only triangles supported");
+            if (elems != 3 && elems != 4) lightwave_throw("only triangles and quads supported");
 
             for (uint32_t elem = 0; elem < elems; ++elem) {
-                indices[indicesIndex][elem] = readIdx();
+                face[elem] = readIdx();
             }
-            indicesIndex++;
+            addFace(elems, face);
+            facesIndex++;
         }
     }
 
-    if (indicesIndex != indices.size()) lightwave_throw("too few faces (%d found, %d needed)", indicesIndex, indices.size());
+    if (facesIndex != header.FaceCount) lightwave_throw("too few faces (%d found, %d needed)", facesIndex, header.FaceCount);
 
     if (!header.hasUVs()) {
         Bounds bbox;
@@ -185,7 +206,8 @@ static inline bool isAllowedVertIndType(const std::string& str) {
 void readPLY(
     const std::filesystem::path &path,
     std::vector<Vector3i> &indices,
-    std::vector<Vertex> &vertices
+    std::vector<Vertex> &vertices,
+    std::vector<Vector4i> *quads
 ) {
     logger(EInfo, "loading mesh %s", path);
     try {
@@ -266,7 +288,177 @@ void readPLY(
 
         header.SwitchEndianness = (method == "binary_big_endian");
         header.IsAscii          = (method == "ascii");
-        readPlyContent(stream, header, indices, vertices);
+        readPlyContent(stream, header, indices, vertices, quads);
+    } catch (...) {
+        lightwave_throw_nested("while parsing %s", path);
+    }
+}
+
+/// @brief A property of the vertices of a PLY point file, which can be of any scalar type.
+struct PointProperty {
+    /// @brief The size of the property in bytes.
+    int size;
+    /// @brief Whether the property is stored as floating point number.
+    bool isFloat;
+    /// @brief Whether the property is stored as signed integer.
+    bool isSigned;
+    /// @brief Where the value is stored (0 to 2 for the position, 3 for the radius, 4 for the material, -1 if unused).
+    int target;
+};
+
+static PointProperty parsePointProperty(const std::string &type, const std::string &name) {
+    PointProperty property;
+    if      (type == "char"   || type == "int8")    property = { 1, false, true,  -1 };
+    else if (type == "uchar"  || type == "uint8")   property = { 1, false, false, -1 };
+    else if (type == "short"  || type == "int16")   property = { 2, false, true,  -1 };
+    else if (type == "ushort" || type == "uint16")  property = { 2, false, false, -1 };
+    else if (type == "int"    || type == "int32")   property = { 4, false, true,  -1 };
+    else if (type == "uint"   || type == "uint32")  property = { 4, false, false, -1 };
+    else if (type == "float"  || type == "float32") property = { 4, true,  true,  -1 };
+    else if (type == "double" || type == "float64") property = { 8, true,  true,  -1 };
+    else lightwave_throw("unsupported property type '%s'", type);
+
+    if      (name == "x") property.target = 0;
+    else if (name == "y") property.target = 1;
+    else if (name == "z") property.target = 2;
+    else if (name == "radius") property.target = 3;
+    else if (name == "material" || name == "material_index") property.target = 4;
+    return property;
+}
+
+/// @brief Reads a binary property value and converts it to double (which represents all supported types exactly).
+static double readPointProperty(const char *data, const PointProperty &property, bool switchEndianness) {
+    char bytes[8];
+    std::copy(data, data + property.size, bytes);
+    if (switchEndianness) {
+        std::reverse(bytes, bytes + property.size);
+    }
+
+    const auto read = [&]<typename T>(T) {
+        T value;
+        std::memcpy(&value, bytes, sizeof(T));
+        return double(value);
+    };
+    if (property.isFloat) {
+        return property.size == 4 ? read(float()) : read(double());
+    }
+    switch (property.size) {
+    case 1: return property.isSigned ? read(int8_t()) : read(uint8_t());
+    case 2: return property.isSigned ? read(int16_t()) : read(uint16_t());
+    default: return property.isSigned ? read(int32_t()) : read(uint32_t());
+    }
+}
+
+void readPLYPoints(
+    const std::filesystem::path &path,
+    std::vector<float> (&positions)[3],
+    std::vector<float> &radii,
+    std::vector<uint16_t> &materials
+) {
+    logger(EInfo, "loading points %s", path);
+    try {
+        std::fstream stream(path, std::ios::in | std::ios::binary);
+        if (!stream)
+            lightwave_throw("error opening file");
+
+        std::string magic;
+        stream >> magic;
+        if (magic != "ply")
+            lightwave_throw("file is not in PLY format");
+
+        // Header
+        std::string method;
+        int vertexCount = -1;
+        bool isVertexElement = false;
+        bool isFirstElement = true;
+        std::vector<PointProperty> properties;
+        for (std::string line; std::getline(stream, line);) {
+            std::stringstream sstream(line);
+
+            std::string action;
+            sstream >> action;
+            if (action == "format") {
+                sstream >> method;
+            } else if (action == "element") {
+                std::string type;
+                sstream >> type;
+                isVertexElement = type == "vertex";
+                if (isVertexElement) {
+                    if (!isFirstElement)
+                        lightwave_throw("the vertices need to be the first element");
+                    sstream >> vertexCount;
+                }
+                isFirstElement = false;
+            } else if (action == "property" && isVertexElement) {
+                std::string type, name;
+                sstream >> type >> name;
+                if (type == "list")
+                    lightwave_throw("list properties are not supported for points");
+                properties.push_back(parsePointProperty(type, name));
+            } else if (action == "end_header") {
+                break;
+            }
+        }
+
+        bool hasTarget[5] = {};
+        int vertexSize = 0;
+        for (const PointProperty &property : properties) {
+            if (property.target >= 0) hasTarget[property.target] = true;
+            vertexSize += property.size;
+        }
+        if (vertexCount <= 0 || !hasTarget[0] || !hasTarget[1] || !hasTarget[2])
+            lightwave_throw("does not contain valid point data");
+
+        for (int dim = 0; dim < 3; dim++) {
+            positions[dim].resize(vertexCount);
+        }
+        radii.assign(hasTarget[3] ? vertexCount : 0, 0);
+        materials.assign(hasTarget[4] ? vertexCount : 0, 0);
+
+        const auto store = [&](int vertex, const PointProperty &property, double value) {
+            if (property.target >= 0 && property.target < 3) {
+                positions[property.target][vertex] = float(value);
+            } else if (property.target == 3) {
+                radii[vertex] = float(value);
+            } else if (property.target == 4) {
+                if (value < 0 || value > UINT16_MAX)
+                    lightwave_throw("invalid material index %f", value);
+                materials[vertex] = uint16_t(value);
+            }
+        };
+
+        // Content
+        if (method == "ascii") {
+            for (int vertex = 0; vertex < vertexCount; vertex++) {
+                std::string line;
+                if (!std::getline(stream, line))
+                    lightwave_throw("not enough vertices given");
+                std::stringstream sstream(line);
+                for (const PointProperty &property : properties) {
+                    double value = 0;
+                    sstream >> value;
+                    store(vertex, property, value);
+                }
+            }
+        } else {
+            // read the vertices in blocks, which is much faster than reading them value by value
+            const bool switchEndianness = method == "binary_big_endian";
+            constexpr int BlockSize = 65536;
+            std::vector<char> block(size_t(BlockSize) * vertexSize);
+            for (int first = 0; first < vertexCount; first += BlockSize) {
+                const int count = std::min(BlockSize, vertexCount - first);
+                if (!stream.read(block.data(), std::streamsize(count) * vertexSize))
+                    lightwave_throw("not enough vertices given");
+
+                const char *data = block.data();
+                for (int vertex = first; vertex < first + count; vertex++) {
+                    for (const PointProperty &property : properties) {
+                        store(vertex, property, readPointProperty(data, property, switchEndianness));
+                        data += property.size;
+                    }
+                }
+            }
+        }
     } catch (...) {
         lightwave_throw_nested("while parsing %s", path);
     }
@@ -6,10 +6,24 @@
 
 namespace lightwave {
 
+/// @brief Loads a mesh of triangles and quads. Quads are stored in @c quads if given, or split into two triangles.
 void readPLY(
     const std::filesystem::path &path,
     std::vector<Vector3i> &indices,
-    std::vector<Vertex> &vertices
+    std::vector<Vertex> &vertices,
+    std::vector<Vector4i> *quads = nullptr
+);
+
+/**
+ * @brief Loads the vertices of a PLY file as points (e.g., particles), ignoring all other elements.
+ * The optional @c radius and @c material (or @c material_index ) properties are read into @c radii and
+ * @c materials , which are left empty if the file does not have them.
+ */
+void readPLYPoints(
+    const std::filesystem::path &path,
+    std::vector<float> (&positions)[3],
+    std::vector<float> &radii,
+    std::vector<uint16_t> &materials
 );
 
 }
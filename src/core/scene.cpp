@@ -2,16 +2,56 @@
 #include <lightwave/registry.hpp>
 #include <lightwave/integrator.hpp>
 #include <lightwave/shape.hpp>
+#include <lightwave/instance.hpp>
 #include <lightwave/camera.hpp>
 #include <lightwave/light.hpp>
 #include <lightwave/profiler.hpp>
 
+#include <atomic>
+#include <unordered_set>
+
 namespace lightwave {
 
+/// @brief An entry of the per-thread occluder cache, which remembers the last occluder towards a light.
+struct CachedOccluder {
+    uint64_t sceneKey = 0;
+    const Light *light = nullptr;
+    Occluder occluder;
+};
+/// @brief The number of entries of the occluder cache of each thread (lights are mapped to entries by their address).
+static constexpr int OccluderCacheSize = 64;
+static thread_local CachedOccluder occluderCache[OccluderCacheSize];
+/// @brief The number of scenes that have been loaded, which is used to tell their cache entries apart.
+static std::atomic<uint64_t> sceneCount = 0;
+
+/// @brief Tests whether a cached occluder blocks a ray in world coordinates.
+static bool isOccludedBy(const Occluder &occluder, const Ray &ray, Intersection &its, Sampler &rng) {
+    return occluder.instance
+        ? occluder.instance->occludedBy(occluder, ray, its, rng)
+        : occluder.shape->occludedPrimitive(occluder.primitiveIndex, ray, its, rng);
+}
+
+/// @brief Reports whether any instance within a shape is alpha masked or filled with a medium.
+static bool hasStochasticShapes(const Shape &shape, std::unordered_set<const Shape *> &visited) {
+    if (!visited.insert(&shape).second) {
+        return false;
+    }
+    if (const auto instance = dynamic_cast<const Instance *>(&shape)) {
+        if (instance->alphaMask() || instance->hasMedium()) {
+            return true;
+        }
+    }
+    bool result = false;
+    shape.forEachChild([&](const Shape &child) { result = result || hasStochasticShapes(child, visited); });
+    return result;
+}
+
 Scene::Scene(const Properties &properties) {
     m_camera = properties.getChild<Camera>();
     m_background = properties.getOptionalChild<BackgroundLight>();
     m_lights = properties.getChildren<Light>();
+    m_occluderCache = properties.get<bool>("occluderCache", false);
+    m_occluderCacheKey = ++sceneCount;
     
     const std::vector<ref<Shape>> entities = properties.getChildren<Shape>();
     if (entities.size() == 1) {
@@ -21,6 +61,9 @@ Scene::Scene(const Properties &properties) {
     }
 
     m_shape->markAsVisible();
+
+    std::unordered_set<const Shape *> visited;
+    m_hasStochasticShapes = hasStochasticShapes(*m_shape, visited);
 }
 
 std::string Scene::toString() const {
@@ -38,15 +81,64 @@ Intersection Scene::intersect(const Ray &ray, Sampler &rng) const {
     PROFILE("Intersect")
 
     Intersection its(-ray.direction);
+    its.rayType = ray.depth == 0 ? CameraRay : IndirectRay;
     m_shape->intersect(ray, its, rng);
+    // surface attributes are only computed for the closest hit
+    its.populateDeferred();
     return its;
 }
 
-bool Scene::intersect(const Ray &ray, float tMax, Sampler &rng) const {
+void Scene::intersect(int count, const Ray *rays, Intersection *its, Sampler *const *rngs) const {
+    PROFILE("Intersect")
+
+    for (int i = 0; i < count; i++) {
+        its[i] = Intersection(-rays[i].direction);
+        its[i].rayType = rays[i].depth == 0 ? CameraRay : IndirectRay;
+    }
+    if (m_hasStochasticShapes) {
+        // the random numbers would be consumed in the order of the packet traversal, which differs from that of
+        // the individual rays
+        for (int i = 0; i < count; i++) {
+            m_shape->intersect(rays[i], its[i], *rngs[i]);
+        }
+    } else {
+        m_shape->intersectPacket(rays, its, rngs, count == MaxPacketSize ? ~RayMask(0) : (RayMask(1) << count) - 1);
+    }
+    for (int i = 0; i < count; i++) {
+        its[i].populateDeferred();
+    }
+}
+
+bool Scene::intersect(const Ray &ray, float tMax, Sampler &rng, const Light *light) const {
     PROFILE("Shadow ray")
 
     Intersection its(-ray.direction, tMax * (1 - Epsilon));
-    return m_shape->intersect(ray, its, rng);
+    its.rayType = ShadowRay;
+    if (!m_occluderCache || !light) {
+        return m_shape->occluded(ray, its, rng);
+    }
+
+    CachedOccluder &cached = occluderCache[(reinterpret_cast<uintptr_t>(light) / sizeof(void *)) % OccluderCacheSize];
+    if (cached.sceneKey == m_occluderCacheKey && cached.light == light && cached.occluder.shape) {
+        // the number of calls of these blocks gives the hit rate of the cache in the profile
+        PROFILE("Cached occluder")
+        if (isOccludedBy(cached.occluder, ray, its, rng)) {
+            PROFILE("Cached occluder hit")
+            return true;
+        }
+    }
+
+    if (!m_shape->occluded(ray, its, rng)) {
+        return false;
+    }
+    if (its.occluder.shape) {
+        cached = { m_occluderCacheKey, light, its.occluder };
+    }
+    return true;
+}
+
+bool Scene::setFrame(int frame) {
+    return m_shape->setFrame(frame);
 }
 
 BackgroundLightEval Scene::evaluateBackground(const Vector &direction) const {
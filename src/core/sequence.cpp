@@ -0,0 +1,66 @@
+#include <lightwave.hpp>
+
+namespace lightwave {
+
+/**
+ * @brief Renders a range of frames of an animation with the given integrator.
+ * Before rendering each frame, the scene is switched to it (see @ref Scene::setFrame ), which moves animated instances
+ * and loads deformed meshes, while the bottom-level BVHs of unchanged meshes are kept as they are.
+ * Every frame is saved as a separate image, whose id is suffixed by the frame number (e.g., @c "render_0003.exr" ).
+ */
+class Sequence : public Executable {
+    /// @brief The integrator that renders the individual frames.
+    ref<SamplingIntegrator> m_integrator;
+    /// @brief The first frame to render.
+    int m_firstFrame;
+    /// @brief The number of frames to render.
+    int m_frameCount;
+
+public:
+    Sequence(const Properties &properties) {
+        m_integrator = properties.getChild<SamplingIntegrator>();
+        m_firstFrame = properties.get<int>("first", 0);
+        m_frameCount = properties.get<int>("frames");
+    }
+
+    void execute() override {
+        Image *image = m_integrator->image();
+        if (!image) {
+            lightwave_throw("<sequence /> needs an integrator with an <image /> child to render into!");
+        }
+        const std::string baseId = image->id();
+
+        for (int frame = m_firstFrame; frame < m_firstFrame + m_frameCount; frame++) {
+            Timer updateTimer;
+            const bool changed = m_integrator->scene()->setFrame(frame);
+            logger(EInfo, "frame %d: %s scene in %.1f ms", frame,
+                changed ? "updated" : "kept",
+                updateTimer.getElapsedTime() * 1000
+            );
+
+            Timer renderTimer;
+            image->setId(tfm::format("%s_%04d", baseId, frame));
+            m_integrator->execute();
+            logger(EInfo, "frame %d: rendered in %.1f s", frame, renderTimer.getElapsedTime());
+        }
+
+        image->setId(baseId);
+    }
+
+    std::string toString() const override {
+        return tfm::format(
+            "Sequence[\n"
+            "  integrator = %s,\n"
+            "  first = %d,\n"
+            "  frames = %d\n"
+            "]",
+            indent(m_integrator),
+            m_firstFrame,
+            m_frameCount
+        );
+    }
+};
+
+}
+
+REGISTER_CLASS(Sequence, "sequence", "default")
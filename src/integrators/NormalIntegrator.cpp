@@ -28,10 +28,13 @@ public:
      */
     Color Li(const Ray &ray, Sampler &rng) override {
         // Intersect the ray against the scene and get the intersection information
+        return primaryLi(ray, m_scene->intersect(ray, rng), rng);
+    }
+
+    Color primaryLi(const Ray &ray, const Intersection &its, Sampler &rng) override {
         // If an intersection occurs, store the normal at that intersection or 0 if no intersection
         Vector normal;
-        
-        Intersection its = m_scene->intersect(ray,rng);
+
         if (!its) { //TODO what should tmax be?
             normal = Vector(0);
         }
@@ -50,6 +53,10 @@ public:
         return Color(normal[0], normal[1], normal[2]);
     }
 
+    bool usesPrimaryHits() const override {
+        return true;
+    }
+
     /// @brief An optional textual representation of this class, which can be useful for debugging. 
     std::string toString() const override {
         return tfm::format(
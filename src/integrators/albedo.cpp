@@ -11,9 +11,10 @@ public:
     }
 
     Color Li(const Ray &ray, Sampler &rng) override {
+        return primaryLi(ray, m_scene->intersect(ray, rng), rng);
+    }
 
-        Intersection its = m_scene->intersect(ray,rng);
-
+    Color primaryLi(const Ray &ray, const Intersection &its, Sampler &rng) override {
         if (!its) {
             return Color(1);
         }
@@ -21,6 +22,10 @@ public:
         return its.evaluateAlbedo().value;
     }
 
+    bool usesPrimaryHits() const override {
+        return true;
+    }
+
     /// @brief An optional textual representation of this class, which can be useful for debugging. 
     std::string toString() const override {
         return tfm::format(
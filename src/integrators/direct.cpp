@@ -14,9 +14,11 @@ public:
      * This will be run for each pixel of the image, potentially with multiple samples for each pixel.
      */
     Color Li(const Ray &ray, Sampler &rng) override {
-
         // Compute the intersection object
-        Intersection its = m_scene->intersect(ray,rng);
+        return primaryLi(ray, m_scene->intersect(ray, rng), rng);
+    }
+
+    Color primaryLi(const Ray &ray, const Intersection &its, Sampler &rng) override {
         // start without color 
         Color ray_color = Color(0.0f);
 
@@ -52,7 +54,7 @@ public:
                     // something before that light source
                     Ray check_for_visibility_ray = Ray(its.position, d.wi);
 
-                    if (!m_scene->intersect(check_for_visibility_ray, d.distance, rng)) {
+                    if (!m_scene->intersect(check_for_visibility_ray, d.distance, rng, light_sample.light)) {
                         // the light is visible
                         BsdfEval eval = its.evaluateBsdf(d.wi);
                         ray_color += d.weight * eval.value / light_sample.probability;
@@ -60,7 +62,7 @@ public:
                 }
             }
             // create the secondary ray 
-            Ray secondary_ray = Ray(its.position, bsdfsample.wi.normalized());
+            Ray secondary_ray = Ray(its.position, bsdfsample.wi.normalized(), ray.depth + 1);
             Intersection secondary_its = m_scene->intersect(secondary_ray, rng);
             // Intersection of the secondary ray
             if (secondary_its) {
@@ -76,6 +78,10 @@ public:
         return ray_color;
     }
 
+    bool usesPrimaryHits() const override {
+        return true;
+    }
+
     /// @brief An optional textual representation of this class, which can be useful for debugging. 
     std::string toString() const override {
         return tfm::format(
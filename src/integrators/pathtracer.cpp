@@ -1,15 +1,76 @@
 #include <lightwave.hpp>
+#include "../shapes/bvh.hpp"
+
+#include <algorithm>
+#include <vector>
 
 namespace lightwave {
 
 class pathtracer : public SamplingIntegrator {
 int depth;
 bool nee;
+/// @brief Whether the paths of a block are traced bounce by bounce, with their rays sorted for coherence.
+bool sortRays;
+
+    /// @brief A path that is traced together with the other paths of a block (see @ref primaryLiBatch ).
+    struct PathState {
+        Ray ray;
+        Intersection its;
+        Color Li;
+        Color weight;
+        bool isAlive;
+        /// @brief Whether the next-event estimation at the current vertex waits for its shadow ray.
+        bool hasShadowRay;
+        bool isOccluded;
+        DirectLightSample dls;
+        const Light *light;
+        float lightProbability;
+    };
+
+    /**
+     * @brief Computes the key by which rays are sorted: the octant of the direction, followed by the Morton code of
+     * the cell of the origin in a grid of 256^3 cells over the scene bounds.
+     */
+    static uint32_t rayKey(const Ray &ray, const Bounds &bounds, const float *cellScale) {
+        uint32_t cell[3];
+        uint32_t key = 0;
+        for (int dim = 0; dim < 3; dim++) {
+            // written so that NaNs (e.g., of unbounded scenes) map to 0
+            const float offset = (ray.origin[dim] - bounds.min()[dim]) * cellScale[dim];
+            cell[dim] = offset > 0 ? uint32_t(std::min(offset, 255.f)) : 0;
+            key |= uint32_t(ray.direction[dim] < 0) << (26 - dim);
+        }
+        return key | uint32_t(mortonCode(cell[0], cell[1], cell[2]));
+    }
+
+    /// @brief Sorts the indices of the given paths by the keys of their rays (@c PathState::ray or the shadow rays).
+    void sortPaths(std::vector<int> &order, const std::vector<PathState> &paths, bool shadowRays) const {
+        const Bounds bounds = m_scene->getBoundingBox();
+        float cellScale[3];
+        for (int dim = 0; dim < 3; dim++) {
+            const float extent = bounds.max()[dim] - bounds.min()[dim];
+            cellScale[dim] = extent > 0 ? 256 / extent : 0;
+        }
+
+        std::vector<std::pair<uint32_t, int>> keys;
+        keys.reserve(order.size());
+        for (int index : order) {
+            const PathState &path = paths[index];
+            const Ray ray = shadowRays ? Ray(path.its.position, path.dls.wi) : path.ray;
+            keys.emplace_back(rayKey(ray, bounds, cellScale), index);
+        }
+        std::sort(keys.begin(), keys.end());
+        for (size_t i = 0; i < keys.size(); i++) {
+            order[i] = keys[i].second;
+        }
+    }
+
 public:
     pathtracer(const Properties &properties)
         : SamplingIntegrator(properties) {
         depth = properties.get<int>("depth", 1);
         nee = m_scene->hasLights();
+        sortRays = properties.get<bool>("sortRays", false);
     }
 
     /**
@@ -17,11 +78,16 @@ public:
      * This will be run for each pixel of the image, potentially with multiple samples for each pixel.
      */
     Color Li(const Ray &ray, Sampler &rng) override {
+        return primaryLi(ray, m_scene->intersect(ray, rng), rng);
+    }
+
+    Color primaryLi(const Ray &ray, const Intersection &its, Sampler &rng) override {
         Ray current_ray = ray;
         Color Li = Color(0);
         Color weight = Color(1);
         for (int current_depth = 0; current_depth < depth; current_depth++) {
-            Intersection intersection = m_scene->intersect(current_ray, rng);
+            // the camera ray has already been intersected
+            Intersection intersection = current_depth == 0 ? its : m_scene->intersect(current_ray, rng);
             // handle escaping rays
             if (!intersection) {
                 Li += weight * m_scene->evaluateBackground(current_ray.direction).value;
@@ -47,7 +113,7 @@ public:
                     // something before that light source
                     Ray check_for_visibility_ray = Ray(intersection.position, dls.wi);
 
-                    if (!m_scene->intersect(check_for_visibility_ray, dls.distance, rng)) {
+                    if (!m_scene->intersect(check_for_visibility_ray, dls.distance, rng, light_sample.light)) {
                         // the light is visible
                         BsdfEval eval = intersection.evaluateBsdf(dls.wi);
                         Li += dls.weight * eval.value / light_sample.probability * weight;
@@ -63,10 +129,121 @@ public:
 
             current_ray.origin = intersection.position;
             current_ray.direction = bsdfsample.wi;
+            current_ray.depth = current_depth + 1;
         }
         return Li;
     }
 
+    /**
+     * @brief Traces the paths of a block bounce by bounce, and sorts the shadow and extension rays of each bounce by
+     * direction octant and origin, so that neighbouring rays traverse similar parts of the scene.
+     * Every path performs the same steps (with its own random number generator) as @ref primaryLi , hence the results
+     * are identical.
+     */
+    void primaryLiBatch(int count, const Ray *rays, const Intersection *its, Sampler *const *rngs,
+                        Color *results) override {
+        if (!sortRays) {
+            SamplingIntegrator::primaryLiBatch(count, rays, its, rngs, results);
+            return;
+        }
+
+        std::vector<PathState> paths(count);
+        for (int i = 0; i < count; i++) {
+            paths[i].ray = rays[i];
+            paths[i].its = its[i];
+            paths[i].Li = Color(0);
+            paths[i].weight = Color(1);
+            paths[i].isAlive = true;
+        }
+
+        std::vector<int> shadowOrder, rayOrder;
+        for (int current_depth = 0; current_depth < depth; current_depth++) {
+            // shade the current vertices, and collect the shadow rays of next-event estimation
+            shadowOrder.clear();
+            for (int i = 0; i < count; i++) {
+                PathState &path = paths[i];
+                if (!path.isAlive) continue;
+                path.hasShadowRay = false;
+                if (!path.its) {
+                    path.Li += path.weight * m_scene->evaluateBackground(path.ray.direction).value;
+                    path.isAlive = false;
+                    continue;
+                }
+                path.Li += path.weight * path.its.evaluateEmission();
+
+                if (current_depth >= depth - 1) {
+                    path.isAlive = false;
+                    continue;
+                }
+
+                if (nee) {
+                    LightSample light_sample = m_scene->sampleLight(*rngs[i]);
+                    path.dls = light_sample.light->sampleDirect(path.its.position, *rngs[i]);
+                    if (path.dls.isInvalid()) {
+                        path.isAlive = false;
+                        continue;
+                    }
+                    // avoid double counting
+                    if (light_sample.light->canBeIntersected() == false) {
+                        path.hasShadowRay = true;
+                        path.light = light_sample.light;
+                        path.lightProbability = light_sample.probability;
+                        shadowOrder.push_back(i);
+                    }
+                }
+            }
+
+            sortPaths(shadowOrder, paths, true);
+            for (int i : shadowOrder) {
+                PathState &path = paths[i];
+                path.isOccluded = m_scene->intersect(Ray(path.its.position, path.dls.wi), path.dls.distance, *rngs[i],
+                                                     path.light);
+            }
+
+            // finish next-event estimation and sample the next directions
+            rayOrder.clear();
+            for (int i = 0; i < count; i++) {
+                PathState &path = paths[i];
+                if (!path.isAlive) continue;
+                if (path.hasShadowRay && !path.isOccluded) {
+                    // the light is visible
+                    BsdfEval eval = path.its.evaluateBsdf(path.dls.wi);
+                    path.Li += path.dls.weight * eval.value / path.lightProbability * path.weight;
+                }
+
+                BsdfSample bsdfsample = path.its.sampleBsdf(*rngs[i]);
+                if (bsdfsample.isInvalid()) {
+                    path.isAlive = false;
+                    continue;
+                }
+
+                path.weight *= bsdfsample.weight;
+
+                path.ray.origin = path.its.position;
+                path.ray.direction = bsdfsample.wi;
+                path.ray.depth = current_depth + 1;
+                rayOrder.push_back(i);
+            }
+
+            sortPaths(rayOrder, paths, false);
+            for (int i : rayOrder) {
+                paths[i].its = m_scene->intersect(paths[i].ray, *rngs[i]);
+            }
+        }
+
+        for (int i = 0; i < count; i++) {
+            results[i] = paths[i].Li;
+        }
+    }
+
+    bool usesPrimaryHits() const override {
+        return true;
+    }
+
+    bool tracesPathsTogether() const override {
+        return sortRays;
+    }
+
     /// @brief An optional textual representation of this class, which can be useful for debugging. 
     std::string toString() const override {
         return tfm::format(
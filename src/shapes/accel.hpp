@@ -3,12 +3,136 @@
 #include <lightwave/core.hpp>
 #include <lightwave/math.hpp>
 #include <lightwave/shape.hpp>
+#include <lightwave/iterators.hpp>
+#include <lightwave/parallel.hpp>
 
+#include "bvh.hpp"
+#include "widebvh.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <atomic>
+#include <cassert>
+#include <memory>
+#include <mutex>
 #include <numeric>
+#include <unordered_map>
 
 namespace lightwave
 {
 
+    /// @brief Describes the shape and quality of a BVH (see @ref AccelerationStructure::statistics ).
+    struct BvhStatistics
+    {
+        /// @brief The number of internal nodes.
+        size_t internalNodes = 0;
+        /// @brief The number of leaves.
+        size_t leaves = 0;
+        /// @brief The number of primitive references in all leaves (which
+        /// exceeds the number of primitives if spatial splits are used).
+        size_t references = 0;
+        /// @brief The SAH cost of the tree, relative to the surface area of the
+        /// root (i.e., the expected cost of a ray that hits the root).
+        float sahCost = 0;
+        /// @brief The largest number of internal nodes above a leaf.
+        int maxDepth = 0;
+        /// @brief The average number of internal nodes above a leaf.
+        float averageDepth = 0;
+        /// @brief The number of leaves for each leaf size (i.e., @c leafSizes[n]
+        /// leaves contain @c n primitives).
+        std::vector<size_t> leafSizes;
+        /**
+         * @brief The summed surface area of the overlaps of all pairs of
+         * siblings, relative to the summed surface area of their parents. Large
+         * values indicate that rays need to visit many subtrees.
+         */
+        float siblingOverlap = 0;
+    };
+
+    /// @brief The work done by the traversals of a single acceleration structure.
+    struct TraversalCounts
+    {
+        /// @brief The number of rays that have traversed the structure.
+        long traversals = 0;
+        /// @brief The number of nodes tested by all traversals.
+        long nodes = 0;
+        /// @brief The number of primitives tested by all traversals.
+        long primitives = 0;
+    };
+
+    class AccelerationStructure;
+
+    /**
+     * @brief While it exists, records the nodes and primitives tested by each
+     * acceleration structure (excluding those of nested acceleration structures,
+     * e.g., the meshes within a group).
+     * @warning Only one recorder can exist at a time, and rays must only be
+     * traced by the thread that created it while it exists.
+     */
+    class TraversalRecorder
+    {
+        /// @brief The counts of each acceleration structure that has been traversed.
+        std::unordered_map<const AccelerationStructure *, TraversalCounts> m_counts;
+        /// @brief The number of nodes and primitives that have already been
+        /// attributed to a structure, which excludes them from the enclosing
+        /// structures.
+        long m_claimedNodes = 0, m_claimedPrimitives = 0;
+
+        static TraversalRecorder *&current()
+        {
+            static TraversalRecorder *recorder = nullptr;
+            return recorder;
+        }
+
+    public:
+        TraversalRecorder()
+        {
+            assert(!current());
+            current() = this;
+        }
+        ~TraversalRecorder() { current() = nullptr; }
+        TraversalRecorder(const TraversalRecorder &) = delete;
+        TraversalRecorder &operator=(const TraversalRecorder &) = delete;
+
+        /// @brief Returns the recorder that currently exists (or null).
+        static TraversalRecorder *active() { return current(); }
+
+        /// @brief Returns the counts recorded for the given structure.
+        TraversalCounts counts(const AccelerationStructure *structure) const
+        {
+            const auto it = m_counts.find(structure);
+            return it == m_counts.end() ? TraversalCounts() : it->second;
+        }
+
+        /**
+         * @brief Runs a traversal of the given structure, and attributes the
+         * statistics that it adds to @c its.stats (and that have not been
+         * attributed to nested structures) to it.
+         */
+        template <typename Traverse>
+        bool record(const AccelerationStructure *structure, const Intersection &its,
+                    Traverse &&traverse)
+        {
+            const long nodesBefore = its.stats.bvhCounter;
+            const long primitivesBefore = its.stats.primCounter;
+            const long claimedNodes = m_claimedNodes;
+            const long claimedPrimitives = m_claimedPrimitives;
+
+            const bool result = traverse();
+
+            const long nodes = its.stats.bvhCounter - nodesBefore;
+            const long primitives = its.stats.primCounter - primitivesBefore;
+            TraversalCounts &counts = m_counts[structure];
+            counts.traversals++;
+            counts.nodes += nodes - (m_claimedNodes - claimedNodes);
+            counts.primitives += primitives - (m_claimedPrimitives - claimedPrimitives);
+            m_claimedNodes = claimedNodes + nodes;
+            m_claimedPrimitives = claimedPrimitives + primitives;
+            return result;
+        }
+    };
+
     /**
      * @brief Parent class for shapes that combine many individual shapes (e.g.,
      * triangle meshes), and hence benefit from building an acceleration structure
@@ -24,6 +148,11 @@ namespace lightwave
      * - getCentroid(primitiveIndex)    -- return the centroid of a single child
      * (used for building the BVH)
      *
+     * Shapes with many children should be declared @c final and override
+     * intersectChildren() and occludedChildren() , passing their own
+     * intersection test to intersectPrimitives() , which removes the virtual
+     * call from the leaf loops.
+     *
      * @example For a simple example of how to use this class, look at @ref
      * shapes/group.cpp
      * @see Group
@@ -35,8 +164,18 @@ namespace lightwave
         /// remapping.
         typedef int32_t NodeIndex;
 
-        /// @brief A node in our binary BVH tree.
-        struct Node
+        /// @brief The size of a cache line in bytes.
+        static constexpr std::size_t CacheLineSize = 64;
+        /// @brief The size of a memory page in bytes.
+        static constexpr std::size_t PageSize = 4096;
+
+        /**
+         * @brief A node in our binary BVH tree.
+         * @note Nodes are exactly 32 bytes large and aligned accordingly, so
+         * that a node never straddles two cache lines, and both children of a
+         * node (which are stored next to each other) share a single cache line.
+         */
+        struct alignas(32) Node
         {
             /// @brief The axis aligned bounding box of this node.
             Bounds aabb;
@@ -74,9 +213,18 @@ namespace lightwave
                 return leftFirst + primitiveCount - 1;
             }
         };
+        static_assert(sizeof(Node) == 32, "BVH nodes must fill half a cache line");
+
+        /// @brief A list of BVH nodes, aligned to cache lines.
+        typedef std::vector<Node, AlignedAllocator<Node, CacheLineSize>> NodeList;
 
-        /// @brief A list of all BVH nodes.
-        std::vector<Node> m_nodes;
+        /**
+         * @brief A list of all BVH nodes.
+         * @note The root node is followed by an unused padding node, so that
+         * the left child of every node has an even index and hence siblings
+         * always share a cache line.
+         */
+        NodeList m_nodes;
         /**
          * @brief Mapping from internal @c NodeIndex to @c primitiveIndex as used by
          * all interface methods. For efficient storage, we assume that children of
@@ -87,6 +235,191 @@ namespace lightwave
          * indices to the indices the user of this class expects.
          */
         std::vector<int> m_primitiveIndices;
+        /**
+         * @brief For every node of m_nodes: The kinds of rays that can hit any
+         * primitive within the node (see @ref primitiveVisibility ), so that
+         * traversal can skip subtrees that a ray cannot hit. Empty if all
+         * primitives can be hit by all rays.
+         */
+        std::vector<uint8_t> m_nodeVisibility;
+
+        struct LazyNode;
+        /// @brief The nodes of a node list that are only subdivided once a ray
+        /// reaches them.
+        struct LazyNodes
+        {
+            /// @brief For every node of the list: The index of its entry in
+            /// @c nodes , or -1 if it is a regular node (empty if no node of
+            /// the list is deferred).
+            std::vector<int> indexOfNode;
+            std::vector<std::unique_ptr<LazyNode>> nodes;
+        };
+        /// @brief A node whose subdivision has been deferred until a ray
+        /// reaches it (see @ref subdivideLazily ).
+        struct LazyNode
+        {
+            /// @brief The deferred node, which acts as leaf until subdivided.
+            Node node;
+            /// @brief The depth of the deferred node in the BVH.
+            int depth;
+            /// @brief Ensures that only the first thread to reach the node
+            /// subdivides it, while all others wait for the result.
+            std::once_flag once;
+            /// @brief Whether @c subtree is available (for inspection only,
+            /// traversal relies on @c once ).
+            std::atomic<bool> isSubdivided = false;
+            /// @brief The subtree that replaces the node, starting with a copy of
+            /// the node as root followed by a padding node (like m_nodes , so
+            /// that siblings share a cache line).
+            NodeList subtree;
+            /// @brief The nodes of the subtree that are deferred again.
+            LazyNodes lazy;
+        };
+        /**
+         * @brief Nodes with more primitives than this are only subdivided once
+         * a ray first reaches them, or 0 to build the entire BVH up front.
+         */
+        int m_lazyThreshold;
+        /// @brief The nodes of m_nodes that are subdivided lazily.
+        LazyNodes m_lazyNodes;
+
+        /// @brief The algorithm used to build the binary BVH.
+        enum class Builder
+        {
+            /// @brief Binned SAH with object splits only.
+            SAH,
+            /// @brief Binned SAH with object and spatial splits (SBVH).
+            SBVH,
+            /// @brief Linear BVH, which splits primitives sorted along a Morton
+            /// curve (fast to build, but lower quality than the SAH builders).
+            LBVH,
+        };
+        Builder m_builder;
+        /// @brief For the LBVH builder: Whether to improve the tree by
+        /// restructuring treelets after the build.
+        bool m_optimizeTreelets;
+        /**
+         * @brief For the LBVH builder: The Morton codes of the primitives, in the
+         * order of m_primitiveIndices (only available during the build, or
+         * while nodes are subdivided lazily).
+         */
+        std::vector<uint64_t> m_mortonCodes;
+        /**
+         * @brief For object split builds: The bounding boxes and centroids of
+         * all primitives (only available during the build, or while nodes are
+         * subdivided lazily). Binning visits
+         * every primitive once per level of the tree, which would otherwise
+         * recompute them through virtual calls every time.
+         */
+        std::vector<Bounds> m_primitiveBounds;
+        /// @copydoc m_primitiveBounds
+        std::vector<Point> m_primitiveCentroids;
+        /**
+         * @brief For the SBVH builder: The number of references that may be
+         * created by spatial splits in addition to the primitives, relative to
+         * the number of primitives.
+         */
+        float m_duplicationBudget;
+
+        /// @brief The largest number of bins per axis used by the SAH builders.
+        int m_maxBins;
+        /// @brief The SAH cost of traversing a node, relative to
+        /// m_intersectionCost .
+        float m_traversalCost;
+        /// @brief The SAH cost of intersecting a primitive.
+        float m_intersectionCost;
+        /// @brief Nodes with more primitives are always split, even if the SAH
+        /// prefers a leaf.
+        int m_maxLeafSize;
+
+        /// @brief The node layout used for traversal.
+        enum class Layout
+        {
+            /// @brief Traverse the binary BVH directly.
+            Binary,
+            /// @brief Collapse the binary BVH into a BVH with four children per node.
+            BVH4,
+            /// @brief Collapse the binary BVH into a BVH with eight children per node.
+            BVH8,
+            /// @brief Like @c BVH4 , but with quantized child bounding boxes.
+            BVH4Quantized,
+            /// @brief Like @c BVH8 , but with quantized child bounding boxes.
+            BVH8Quantized,
+        };
+        Layout m_layout;
+
+        /// @brief The order in which the nodes are stored in m_nodes.
+        enum class NodeOrder
+        {
+            /// @brief Depth-first order, where the children of the left child
+            /// directly follow the children of a node.
+            DepthFirst,
+            /// @brief Subtrees that are likely to be traversed together are
+            /// clustered into treelets that fill a memory page.
+            Treelet,
+        };
+        NodeOrder m_nodeOrder;
+
+        /// @brief The collapsed BVH, if the BVH4 layout is used.
+        WideBVH<4> m_bvh4;
+        /// @brief The collapsed BVH, if the BVH8 layout is used.
+        WideBVH<8> m_bvh8;
+        /// @brief The collapsed BVH, if the quantized BVH4 layout is used.
+        WideBVH<4, true> m_qbvh4;
+        /// @brief The collapsed BVH, if the quantized BVH8 layout is used.
+        WideBVH<8, true> m_qbvh8;
+
+        /// @brief Calls the given function with the wide BVH of the selected
+        /// layout (which must not be the binary layout).
+        template <typename F>
+        decltype(auto) visitWideBVH(F &&f)
+        {
+            switch (m_layout)
+            {
+            case Layout::BVH4:
+                return f(m_bvh4);
+            case Layout::BVH8:
+                return f(m_bvh8);
+            case Layout::BVH4Quantized:
+                return f(m_qbvh4);
+            default:
+                return f(m_qbvh8);
+            }
+        }
+
+        /// @copydoc visitWideBVH
+        template <typename F>
+        decltype(auto) visitWideBVH(F &&f) const
+        {
+            switch (m_layout)
+            {
+            case Layout::BVH4:
+                return f(m_bvh4);
+            case Layout::BVH8:
+                return f(m_bvh8);
+            case Layout::BVH4Quantized:
+                return f(m_qbvh4);
+            default:
+                return f(m_qbvh8);
+            }
+        }
+
+        /// @brief How the BVH is updated when the geometry changes between
+        /// frames of an animation.
+        enum class Update
+        {
+            /// @brief Recompute the bounding boxes, keeping the topology.
+            Refit,
+            /// @brief Build a new BVH from scratch.
+            Rebuild,
+        };
+        Update m_update;
+
+        /// @brief The animation frame the shape is currently set to.
+        int m_frame = 0;
+        /// @brief Whether the geometry changed when switching to the current
+        /// frame.
+        bool m_frameChanged = false;
 
         /// @brief Returns the root BVH node.
         const Node &rootNode() const
@@ -96,79 +429,330 @@ namespace lightwave
         }
 
         /**
-         * @brief Intersects a BVH node, recursing into children (for internal
-         * nodes), or intersecting all primitives (for leaf nodes).
+         * @brief The maximum depth of the BVH, which bounds the size of the
+         * traversal stack. Nodes at this depth are not subdivided any further.
          */
-        bool intersectNode(const Node &node, const Ray &ray, Intersection &its,
-                           Sampler &rng) const
+        static constexpr int MaxDepth = 64;
+
+        /**
+         * @brief Intersects the BVH with a ray, visiting the nodes in the order
+         * they are hit by the ray.
+         * @note Instead of recursing, the children that still need to be
+         * visited are kept on a fixed-size stack along with their entry
+         * distance, which allows skipping them once a closer hit has been found.
+         * @param visibility The visibility of the nodes (see m_nodeVisibility ),
+         * or null if all nodes can be hit.
+         * @param intersectLeaf Called as @code intersectLeaf(first, count) @endcode
+         * for every leaf that might contain a closer hit (see @ref intersectLeaves ).
+         */
+        template <typename IntersectLeaf>
+        bool intersectNodes(const Node *nodes, const LazyNodes &lazy, const uint8_t *visibility,
+                            const Ray &ray, Intersection &its, IntersectLeaf &&intersectLeaf) const
         {
-            // update the statistic tracking how many BVH nodes have been tested for
-            // intersection
-            its.stats.bvhCounter++;
+            const TraversalRay traversalRay(ray);
+            if (!(intersectAABB(nodes[0].aabb, traversalRay) < its.t))
+                return false;
+
+            struct StackEntry
+            {
+                NodeIndex nodeIndex;
+                float t;
+            };
+            StackEntry stack[MaxDepth];
+            int stackSize = 0;
 
             bool wasIntersected = false;
-            if (node.isLeaf())
+            NodeIndex nodeIndex = 0;
+            while (true)
             {
-                for (NodeIndex i = 0; i < node.primitiveCount; i++)
+                const Node &node = nodes[nodeIndex];
+                // update the statistic tracking how many BVH nodes have been
+                // tested for intersection
+                its.stats.bvhCounter++;
+
+                if (node.isLeaf() && isDeferred(lazy, nodeIndex))
+                {
+                    // continue with the subtree that replaces the node
+                    const LazyNode &lazyNode = subdivideLazily(lazy, nodeIndex);
+                    wasIntersected |= intersectNodes(lazyNode.subtree.data(), lazyNode.lazy, nullptr, ray,
+                                                     its, intersectLeaf);
+                }
+                else if (node.isLeaf())
                 {
-                    // update the statistic tracking how many children have been
-                    // tested for intersection
-                    its.stats.primCounter++;
-                    // test the child for intersection
-                    wasIntersected |= intersect(
-                        m_primitiveIndices[node.leftFirst + i], ray, its, rng);
+                    // update the statistic tracking how many children have
+                    // been tested for intersection
+                    its.stats.primCounter += node.primitiveCount;
+                    // test the children for intersection
+                    wasIntersected |= intersectLeaf(node.leftFirst, node.primitiveCount);
+                }
+                else
+                { // internal node
+                    // test which bounding box is intersected first by the ray.
+                    // this allows us to traverse the children in the order they
+                    // are intersected in, which can help prune a lot of
+                    // unnecessary intersection tests.
+                    NodeIndex nearIndex = node.leftChildIndex();
+                    NodeIndex farIndex = node.rightChildIndex();
+                    float nearT = intersectAABB(nodes[nearIndex].aabb, traversalRay);
+                    float farT = intersectAABB(nodes[farIndex].aabb, traversalRay);
+                    if (visibility)
+                    {
+                        // children that the ray cannot hit are treated as missed
+                        if (!(visibility[nearIndex] & its.rayType))
+                            nearT = Infinity;
+                        if (!(visibility[farIndex] & its.rayType))
+                            farT = Infinity;
+                    }
+                    if (!(nearT < farT))
+                    {
+                        std::swap(nearIndex, farIndex);
+                        std::swap(nearT, farT);
+                    }
+
+                    if (nearT < its.t)
+                    {
+                        // visit the near child next, and remember the far child
+                        // for later
+                        if (farT < its.t)
+                            stack[stackSize++] = {farIndex, farT};
+                        nodeIndex = nearIndex;
+                        continue;
+                    }
+                    if (farT < its.t)
+                    {
+                        nodeIndex = farIndex;
+                        continue;
+                    }
                 }
+
+                // continue with the closest pending node that might still contain
+                // a closer intersection
+                do
+                {
+                    if (stackSize == 0)
+                        return wasIntersected;
+                    stackSize--;
+                } while (!(stack[stackSize].t < its.t));
+                nodeIndex = stack[stackSize].nodeIndex;
             }
-            else
-            { // internal node
-                // test which bounding box is intersected first by the ray.
-                // this allows us to traverse the children in the order they are
-                // intersected in, which can help prune a lot of unnecessary
-                // intersection tests.
-                const auto leftT =
-                    intersectAABB(m_nodes[node.leftChildIndex()].aabb, ray);
-                const auto rightT =
-                    intersectAABB(m_nodes[node.rightChildIndex()].aabb, ray);
-                if (leftT < rightT)
-                { // left child is hit first; test left child
-                  // first, then right child
-                    if (leftT < its.t)
-                        wasIntersected |= intersectNode(
-                            m_nodes[node.leftChildIndex()], ray, its, rng);
-                    if (rightT < its.t)
-                        wasIntersected |= intersectNode(
-                            m_nodes[node.rightChildIndex()], ray, its, rng);
+        }
+
+        /**
+         * @brief Tests whether any primitive blocks the ray before @c its.t ,
+         * stopping at the first hit that is found.
+         * @note Since the traversal stops at the first hit anyway, children are
+         * not sorted by distance.
+         * @param occludedLeaf Called as @code occludedLeaf(first, count) @endcode
+         * for every leaf that might block the ray.
+         */
+        template <typename OccludedLeaf>
+        bool occludedNodes(const Node *nodes, const LazyNodes &lazy, const uint8_t *visibility,
+                           const Ray &ray, Intersection &its, OccludedLeaf &&occludedLeaf) const
+        {
+            const TraversalRay traversalRay(ray);
+            if (!(intersectAABB(nodes[0].aabb, traversalRay) < its.t))
+                return false;
+
+            NodeIndex stack[MaxDepth];
+            int stackSize = 0;
+
+            NodeIndex nodeIndex = 0;
+            while (true)
+            {
+                const Node &node = nodes[nodeIndex];
+                its.stats.bvhCounter++;
+
+                if (node.isLeaf() && isDeferred(lazy, nodeIndex))
+                {
+                    const LazyNode &lazyNode = subdivideLazily(lazy, nodeIndex);
+                    if (occludedNodes(lazyNode.subtree.data(), lazyNode.lazy, nullptr, ray, its, occludedLeaf))
+                        return true;
+                }
+                else if (node.isLeaf())
+                {
+                    its.stats.primCounter += node.primitiveCount;
+                    if (occludedLeaf(node.leftFirst, node.primitiveCount))
+                        return true;
                 }
                 else
-                { // right child is hit first; test right child first, then
-                  // left child
-                    if (rightT < its.t)
-                        wasIntersected |= intersectNode(
-                            m_nodes[node.rightChildIndex()], ray, its, rng);
-                    if (leftT < its.t)
-                        wasIntersected |= intersectNode(
-                            m_nodes[node.leftChildIndex()], ray, its, rng);
+                {
+                    const NodeIndex leftIndex = node.leftChildIndex();
+                    bool hitsLeft =
+                        intersectAABB(nodes[leftIndex].aabb, traversalRay) < its.t;
+                    bool hitsRight =
+                        intersectAABB(nodes[leftIndex + 1].aabb, traversalRay) < its.t;
+                    if (visibility)
+                    {
+                        hitsLeft &= (visibility[leftIndex] & its.rayType) != 0;
+                        hitsRight &= (visibility[leftIndex + 1] & its.rayType) != 0;
+                    }
+                    if (hitsLeft)
+                    {
+                        if (hitsRight)
+                            stack[stackSize++] = leftIndex + 1;
+                        nodeIndex = leftIndex;
+                        continue;
+                    }
+                    if (hitsRight)
+                    {
+                        nodeIndex = leftIndex + 1;
+                        continue;
+                    }
+                }
+
+                if (stackSize == 0)
+                    return false;
+                nodeIndex = stack[--stackSize];
+            }
+        }
+
+        /**
+         * @brief Intersects the binary BVH with a packet of rays, which visits
+         * every node once for all rays that might hit it.
+         * @note Instead of testing every ray against every node, a node is
+         * entered by the range of rays from the first to the last ray that hits
+         * its bounding box (which only tests two rays for coherent packets).
+         * The rays in between might miss the node, hence leaves only test the
+         * rays that hit their bounding box. Rays outside of the range have
+         * missed the node, so every ray still visits all leaves that it would
+         * visit on its own, and finds the same closest hit (up to hits at
+         * exactly the same distance).
+         */
+        template <typename TestLeaf>
+        RayMask intersectPacketNodes(const Ray *rays, Intersection *its, RayMask active,
+                                     TestLeaf &&testLeaf) const
+        {
+            TraversalRay traversalRays[MaxPacketSize];
+            for (RayMask remaining = active; remaining; remaining &= remaining - 1)
+            {
+                const int index = std::countr_zero(remaining);
+                traversalRays[index] = TraversalRay(rays[index]);
+            }
+            const uint8_t *visibility = m_nodeVisibility.empty() ? nullptr : m_nodeVisibility.data();
+            const auto hitsNode = [&](NodeIndex nodeIndex, int index)
+            {
+                return (active >> index & 1) &&
+                       (!visibility || (visibility[nodeIndex] & its[index].rayType)) &&
+                       intersectAABB(m_nodes[nodeIndex].aabb, traversalRays[index]) < its[index].t;
+            };
+
+            struct StackEntry
+            {
+                NodeIndex nodeIndex;
+                int first, last;
+            };
+            StackEntry stack[MaxDepth];
+            int stackSize = 0;
+
+            RayMask hits = 0;
+            StackEntry entry = {0, std::countr_zero(active), 63 - std::countl_zero(active)};
+            while (true)
+            {
+                const Node &node = m_nodes[entry.nodeIndex];
+                int first = entry.first, last = entry.last;
+                while (first <= last && !hitsNode(entry.nodeIndex, first))
+                    first++;
+                if (first <= last)
+                {
+                    while (!hitsNode(entry.nodeIndex, last))
+                        last--;
+                    for (int index = first; index <= last; index++)
+                        its[index].stats.bvhCounter += int(active >> index & 1);
+
+                    if (node.isLeaf())
+                    {
+                        RayMask leafRays = 0;
+                        for (int index = first; index <= last; index++)
+                        {
+                            if (index == first || index == last || hitsNode(entry.nodeIndex, index))
+                            {
+                                leafRays |= RayMask(1) << index;
+                                its[index].stats.primCounter += node.primitiveCount;
+                            }
+                        }
+                        hits |= testLeaf(node.leftFirst, node.primitiveCount, leafRays);
+                    }
+                    else
+                    {
+                        // visit the child that the first ray enters first
+                        NodeIndex nearIndex = node.leftChildIndex();
+                        NodeIndex farIndex = node.rightChildIndex();
+                        if (!(intersectAABB(m_nodes[nearIndex].aabb, traversalRays[first]) <
+                              intersectAABB(m_nodes[farIndex].aabb, traversalRays[first])))
+                            std::swap(nearIndex, farIndex);
+                        stack[stackSize++] = {farIndex, first, last};
+                        entry = {nearIndex, first, last};
+                        continue;
+                    }
                 }
+
+                if (stackSize == 0)
+                    return hits;
+                entry = stack[--stackSize];
+            }
+        }
+
+        /// @brief Traverses the BVH in the selected layout, either for the
+        /// closest hit or for any hit.
+        template <bool AnyHit, typename TestLeaf>
+        bool traverse(const Ray &ray, Intersection &its, TestLeaf &&testLeaf) const
+        {
+            const uint8_t *visibility = m_nodeVisibility.empty() ? nullptr : m_nodeVisibility.data();
+            if (visibility && !(visibility[0] & its.rayType))
+                return false;
+
+            if (m_layout == Layout::Binary)
+            {
+                if constexpr (AnyHit)
+                    return occludedNodes(m_nodes.data(), m_lazyNodes, visibility, ray, its, testLeaf);
+                else
+                    return intersectNodes(m_nodes.data(), m_lazyNodes, visibility, ray, its, testLeaf);
             }
-            return wasIntersected;
+            return visitWideBVH([&](const auto &bvh)
+                                { return intersectWide<AnyHit>(bvh, ray, its, testLeaf); });
+        }
+
+        /**
+         * @brief Intersects a wide BVH that has been collapsed from this BVH.
+         * @tparam AnyHit Whether to stop at the first hit (for shadow rays),
+         * instead of finding the closest hit.
+         */
+        template <bool AnyHit, int Width, bool Quantized, typename TestLeaf>
+        bool intersectWide(const WideBVH<Width, Quantized> &bvh, const Ray &ray,
+                           Intersection &its, TestLeaf &testLeaf) const
+        {
+            const TraversalRay traversalRay(ray);
+            if (!(intersectAABB(rootNode().aabb, traversalRay) < its.t))
+                return false;
+
+            return bvh.template traverse<MaxDepth, AnyHit>(
+                traversalRay, its, [&](NodeIndex first, NodeIndex count)
+                {
+                    // update the statistic tracking how many children have
+                    // been tested for intersection
+                    its.stats.primCounter += count;
+                    return testLeaf(first, count); });
         }
 
         /// @brief Performs a slab test to intersect a bounding box with a ray,
         /// returning Infinity in case the ray misses.
-        float intersectAABB(const Bounds &bounds, const Ray &ray) const
+        float intersectAABB(const Bounds &bounds, const TraversalRay &ray) const
         {
-            // but this only saves us ~1%, so let's not do it. intersect all axes at
-            // once with the minimum slabs of the bounding box
-            const auto t1 = (bounds.min() - ray.origin) / ray.direction;
-            // intersect all axes at once with the maximum slabs of the bounding box
-            const auto t2 = (bounds.max() - ray.origin) / ray.direction;
-
-            // the elementwiseMin picks the near slab for each axis, of which we
-            // then take the maximum
-            const auto tNear = elementwiseMin(t1, t2).maxComponent();
-            // the elementwiseMax picks the far slab for each axis, of which we then
-            // take the minimum
-            const auto tFar = elementwiseMax(t1, t2).minComponent();
+            float tNear = -Infinity;
+            float tFar = Infinity;
+            for (int dim = 0; dim < 3; dim++)
+            {
+                // the sign of the direction tells us which of the two slabs is
+                // entered first
+                const float nearSlab =
+                    ray.isNegative[dim] ? bounds.max()[dim] : bounds.min()[dim];
+                const float farSlab =
+                    ray.isNegative[dim] ? bounds.min()[dim] : bounds.max()[dim];
+                tNear = std::max(
+                    tNear, (nearSlab - ray.origin[dim]) * ray.invDirection[dim]);
+                tFar = std::min(
+                    tFar, (farSlab - ray.origin[dim]) * ray.invDirection[dim]);
+            }
 
             if (tFar < tNear)
                 return Infinity; // the ray does not intersect the bounding box
@@ -179,16 +763,79 @@ namespace lightwave
                           // (may also be negative!)
         }
 
-        /// @brief Computes the axis aligned bounding box for a leaf BVH node
-        void computeAABB(Node &node)
+        /// @brief Subtrees with at least this many primitives are split by the
+        /// calling thread, smaller subtrees are handed out as separate build tasks.
+        static constexpr NodeIndex ParallelTaskThreshold = 4096;
+        /// @brief Nodes with at least this many primitives are binned in parallel.
+        static constexpr NodeIndex ParallelBinningThreshold = 65536;
+        /// @brief The number of primitives each thread processes at once when
+        /// binning in parallel.
+        static constexpr NodeIndex ParallelChunkSize = 16384;
+
+        /**
+         * @brief Accumulates a value over the primitives [first, first + count)
+         * of m_primitiveIndices, using all available cores for large ranges
+         * (unless @c parallel is false).
+         * @note Each chunk accumulates into its own copy of @c identity , and the
+         * partial results are combined in chunk order afterwards. All reductions
+         * used by the builder (bounds and counts) are exact, so this gives the
+         * same result as a serial loop.
+         */
+        template <typename T, typename Accumulate, typename Combine>
+        T reducePrimitives(NodeIndex first, NodeIndex count, const T &identity,
+                           Accumulate accumulate, Combine combine, bool parallel) const
         {
-            node.aabb = Bounds::empty();
-            for (NodeIndex i = 0; i < node.primitiveCount; i++)
+            T result = identity;
+            if (!parallel || count < ParallelBinningThreshold)
             {
-                const Bounds childAABB =
-                    getBoundingBox(m_primitiveIndices[node.leftFirst + i]);
-                node.aabb.extend(childAABB);
+                for (NodeIndex i = first; i < first + count; i++)
+                    accumulate(result, m_primitiveIndices[i]);
+                return result;
             }
+
+            const int chunkCount =
+                (count + ParallelChunkSize - 1) / ParallelChunkSize;
+            std::vector<T> partial(chunkCount, identity);
+            for_each_parallel(
+                ChunkedRange(first, first + count, ParallelChunkSize),
+                [&](Range chunk)
+                {
+                    T &chunkResult =
+                        partial[(*chunk.begin() - first) / ParallelChunkSize];
+                    for (int i : chunk)
+                        accumulate(chunkResult, m_primitiveIndices[i]);
+                });
+
+            for (const T &chunkResult : partial)
+                combine(result, chunkResult);
+            return result;
+        }
+
+        /// @brief Computes the axis aligned bounding box for a leaf BVH node
+        /// (see @ref reducePrimitives for @c parallel ).
+        void computeAABB(Node &node, bool parallel) const
+        {
+            node.aabb = reducePrimitives(
+                node.firstPrimitiveIndex(), node.primitiveCount, Bounds::empty(),
+                [&](Bounds &aabb, int primitiveIndex)
+                { aabb.extend(primitiveBounds(primitiveIndex)); },
+                [](Bounds &aabb, const Bounds &other) { aabb.extend(other); }, parallel);
+        }
+
+        /// @brief Returns the bounding box of a primitive, from the cache if
+        /// it is available.
+        Bounds primitiveBounds(int primitiveIndex) const
+        {
+            return m_primitiveBounds.empty() ? getBoundingBox(primitiveIndex)
+                                             : m_primitiveBounds[primitiveIndex];
+        }
+
+        /// @brief Returns the centroid of a primitive, from the cache if it is
+        /// available.
+        Point primitiveCentroid(int primitiveIndex) const
+        {
+            return m_primitiveCentroids.empty() ? getCentroid(primitiveIndex)
+                                                : m_primitiveCentroids[primitiveIndex];
         }
 
         /// @brief Computes the surface area of a bounding box.
@@ -199,129 +846,183 @@ namespace lightwave
                         size.y() * size.z());
         }
 
+        /// @brief Computes the intersection of two bounding boxes, which is
+        /// degenerate (with zero surface area) if they do not overlap.
+        static Bounds overlap(const Bounds &a, const Bounds &b)
+        {
+            Point min, max;
+            for (int dim = 0; dim < 3; dim++)
+            {
+                min[dim] = std::max(a.min()[dim], b.min()[dim]);
+                max[dim] = std::max(min[dim], std::min(a.max()[dim], b.max()[dim]));
+            }
+            return Bounds(min, max);
+        }
+
+        /// @brief A bin of the binned SAH builders.
         struct Bin
         {
             Bounds aabb;
             int count;
         };
 
-        NodeIndex binning(Node &node, int splitAxis)
+        /// @brief The largest number of bins the SAH builders can use per axis.
+        static constexpr int MaxBins = 64;
+        /// @brief The smallest number of bins the SAH builders use per axis.
+        static constexpr int MinBins = 4;
+        typedef std::array<Bin, MaxBins> Bins;
+
+        /// @brief A candidate split found by the SAH builders.
+        struct SplitCandidate
+        {
+            /// @brief The SAH cost of the split (without constant factors).
+            float cost = Infinity;
+            /// @brief The axis perpendicular to the splitting plane.
+            int axis;
+            /// @brief The position of the splitting plane along @c axis .
+            float position;
+            /// @brief Whether references straddling the plane are split.
+            bool isSpatial;
+            /// @brief The bounding boxes of the two children.
+            Bounds left, right;
+        };
+
+        /**
+         * @brief The number of bins used to split a node with the given number of
+         * primitives: small nodes use one bin per primitive, large nodes use up
+         * to @c maxBins bins.
+         */
+        int binCount(size_t primitiveCount) const
+        {
+            return std::clamp(int(std::min(primitiveCount, size_t(MaxBins))), MinBins, m_maxBins);
+        }
+
+        /**
+         * @brief Decides whether a node should be split, by comparing the SAH
+         * cost of the split with the cost of intersecting all primitives of the
+         * node. Nodes with more than @c maxLeafSize primitives are always split.
+         */
+        bool isSplitWorthwhile(const SplitCandidate &split, const Bounds &aabb,
+                               size_t primitiveCount) const
         {
-            // based on:
-            // https://jacco.ompf2.com/2022/04/21/how-to-build-a-bvh-part-3-quick-builds/
+            if (primitiveCount > size_t(m_maxLeafSize))
+                return true;
 
-            int a = splitAxis;
-            NodeIndex splitIndex;
-            float splitPos;
-            const int BINS = 16; // number of bins
-            float bestCost = 1e30f;
+            const float area = surfaceArea(aabb);
+            if (!(area > 0))
+                return true; // degenerate node, the SAH gives no guidance
 
-            // Compute boundsMin and boundsMax by iteratively comparing to the centroid
-            float boundsMin = 1e30f, boundsMax = -1e30f;
-            for (int i = 0; i < node.primitiveCount; i++)
-            {
-                float center = getCentroid(m_primitiveIndices[node.firstPrimitiveIndex() + i])[a];
-                boundsMin = min(boundsMin, center);
-                boundsMax = max(boundsMax, center);
-            }
+            const float intersectionCost = m_intersectionCost * relativeIntersectionCost();
+            const float leafCost = intersectionCost * primitiveCount;
+            const float splitCost = m_traversalCost + intersectionCost * split.cost / area;
+            return splitCost < leafCost;
+        }
 
-            // initializes the bin array with empty bins
-            Bin b = {
-                .aabb = Bounds::empty(),
-                .count = 0,
-            };
-            Bin bin[BINS];
+        /**
+         * @brief Finds the best object split for a BVH node by binning the
+         * centroids of its primitives along all three axes (using all available
+         * cores for large nodes, unless @c parallel is false).
+         */
+        SplitCandidate findObjectSplit(const Node &node, bool parallel) const
+        {
+            SplitCandidate best;
+            best.isSpatial = false;
 
-            std::fill_n(bin, BINS, b);
+            const Bounds centroidBounds = reducePrimitives(
+                node.firstPrimitiveIndex(), node.primitiveCount, Bounds::empty(),
+                [&](Bounds &aabb, int primitiveIndex)
+                { aabb.extend(primitiveCentroid(primitiveIndex)); },
+                [](Bounds &aabb, const Bounds &other) { aabb.extend(other); }, parallel);
 
-            // all coordinates of the centroids on the given axis are the same
-            // handle that case or divide by zero
-            if (boundsMax == boundsMin)
+            const int bins = binCount(node.primitiveCount);
+            // scale is used to convert from a position to a bin index, and is 0
+            // for axes along which all centroids coincide
+            float scale[3];
+            for (int dim = 0; dim < 3; dim++)
             {
-                return node.firstPrimitiveIndex();
+                const float extent = centroidBounds.max()[dim] - centroidBounds.min()[dim];
+                scale[dim] = extent > 0 ? bins / extent : 0;
             }
 
-            // scale is used to convert from a position to a binIndex
-            float scale = (float)BINS / (boundsMax - boundsMin);
-            // iterate over primitives and determine which bin they belong to
-            for (int i = 0; i < node.primitiveCount; i++)
-            {
+            typedef std::array<Bins, 3> AxisBins;
+            AxisBins emptyBins;
+            for (Bins &axis : emptyBins)
+                std::fill_n(axis.begin(), bins, Bin{.aabb = Bounds::empty(), .count = 0});
 
-                // determines which bin to populate
-                int binIndex = min(BINS - 1, (int)(((getCentroid(m_primitiveIndices[node.firstPrimitiveIndex() + i])[a]) - boundsMin) * scale));
-                assert(binIndex >= 0);
-
-                // populate the bin
-                // if statement for the case where the Bin is empty
-                if (bin[binIndex].count != 0)
+            // iterate over primitives and determine which bin they belong to
+            const AxisBins axisBins = reducePrimitives(
+                node.firstPrimitiveIndex(), node.primitiveCount, emptyBins,
+                [&](AxisBins &axisBins, int primitiveIndex)
                 {
-                    bin[binIndex].aabb.extend(getBoundingBox(m_primitiveIndices[node.firstPrimitiveIndex() + i]));
-                }
-                else
+                    const Point centroid = primitiveCentroid(primitiveIndex);
+                    const Bounds aabb = primitiveBounds(primitiveIndex);
+                    for (int dim = 0; dim < 3; dim++)
+                    {
+                        // written so that NaNs (e.g., of unbounded shapes) map to 0
+                        const float offset = (centroid[dim] - centroidBounds.min()[dim]) * scale[dim];
+                        const int binIndex = offset > 0 ? int(std::min(offset, float(bins - 1))) : 0;
+                        axisBins[dim][binIndex].aabb.extend(aabb);
+                        axisBins[dim][binIndex].count++;
+                    }
+                },
+                [&](AxisBins &axisBins, const AxisBins &other)
                 {
-                    Bin temp_bin = {
-                        .aabb = getBoundingBox(m_primitiveIndices[node.firstPrimitiveIndex() + i]),
-                        .count = 0};
-                    bin[binIndex] = temp_bin;
-                }
-                bin[binIndex].count++;
-            }
-
-            // gather data for the spaces between the bins
-            // there are (BINS -1) spaces
-            float leftArea[BINS - 1], rightArea[BINS - 1];
-            int leftCount[BINS - 1], rightCount[BINS - 1];
-            Bounds leftBox, rightBox;
-            leftBox = rightBox = Bounds::empty();
-            int leftSum = 0, rightSum = 0;
+                    for (int dim = 0; dim < 3; dim++)
+                    {
+                        for (int i = 0; i < bins; i++)
+                        {
+                            axisBins[dim][i].aabb.extend(other[dim][i].aabb);
+                            axisBins[dim][i].count += other[dim][i].count;
+                        }
+                    }
+                },
+                parallel);
 
-            // iterate over the bins and fill
-            // the left arrays (starting with i = 0)
-            // the right arrays (starting with i = BINS -2)
-            for (int i = 0; i < BINS - 1; i++)
+            for (int dim = 0; dim < 3; dim++)
             {
-                // += to also include the primitives that where in the previous bins
-                leftSum += bin[i].count;
-                // extend works from the start because there are emtpy bounds
-                leftBox.extend(bin[i].aabb);
-                leftCount[i] = leftSum;
-                leftArea[i] = surfaceArea(leftBox);
-                // leftCount[i]/leftArea[i] contains all primitives from 0..i (inclusive)
-
-                rightSum += bin[BINS - 1 - i].count;
-                rightBox.extend(bin[BINS - 1 - i].aabb);
-                rightCount[BINS - 2 - i] = rightSum;
-                rightArea[BINS - 2 - i] = surfaceArea(rightBox);
-                // rightCount[i]/rightArea[i] contains all primitives from i+1..Bins-1
+                if (scale[dim] > 0)
+                    findBestPlane(axisBins[dim], axisBins[dim], bins, dim,
+                                  centroidBounds.min()[dim], 1 / scale[dim], best);
             }
+            return best;
+        }
 
-            // calculate SAH cost
-            // by computing the cost for each bin and comparing to the best cost
-            // inverse_scale is used to map from binIndex to position
-            float inverse_scale = (boundsMax - boundsMin) / BINS;
-            for (int i = 0; i < BINS - 1; i++)
-            {
-                float planeCost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
-                if (planeCost <= bestCost)
-                {
-                    splitPos = boundsMin + inverse_scale * (i + 1);
-                    bestCost = planeCost;
-                }
-            }
+        /**
+         * @brief For the LBVH builder: Finds the split of a node whose primitives
+         * are sorted by their Morton codes, at the first primitive that differs
+         * from the first primitive of the node in the highest bit (which splits
+         * the node at the middle of one axis of a regular grid). Primitives
+         * with identical codes are split in half.
+         * @return The index of the first primitive of the right child.
+         */
+        NodeIndex findMortonSplit(const Node &node) const
+        {
+            const NodeIndex first = node.firstPrimitiveIndex();
+            const NodeIndex last = node.lastPrimitiveIndex();
+            const uint64_t differingBits = m_mortonCodes[first] ^ m_mortonCodes[last];
+            if (differingBits == 0)
+                return first + node.primitiveCount / 2;
+
+            const uint64_t highestBit = std::bit_floor(differingBits);
+            const auto firstRight = std::partition_point(
+                m_mortonCodes.begin() + first, m_mortonCodes.begin() + last + 1,
+                [&](uint64_t code) { return !(code & highestBit); });
+            return NodeIndex(firstRight - m_mortonCodes.begin());
+        }
 
-            // iterates left to right
-            // l
+        /**
+         * @brief Re-orders the primitives of a node so that those whose centroid
+         * lies left of the given plane come first.
+         * @return The index of the first primitive right of the plane.
+         */
+        NodeIndex partitionPrimitives(const Node &node, int axis, float position)
+        {
+            // partition algorithm (you might remember this from quicksort)
             NodeIndex firstRightIndex = node.firstPrimitiveIndex();
-            // iterates right to left
-            // r
             NodeIndex lastLeftIndex = node.lastPrimitiveIndex();
-
-            // partition algorithm, that is also used below when we do "split in the middle"
             while (firstRightIndex <= lastLeftIndex)
             {
-                if (getCentroid(
-                        m_primitiveIndices[firstRightIndex])[splitAxis] <
-                    splitPos)
+                if (primitiveCentroid(m_primitiveIndices[firstRightIndex])[axis] < position)
                 {
                     firstRightIndex++;
                 }
@@ -331,143 +1032,1632 @@ namespace lightwave
                               m_primitiveIndices[lastLeftIndex--]);
                 }
             }
-            // lastLeftIndex+1 = firstRightIndex is the Index at which we want to split
-            splitIndex = lastLeftIndex + 1;
-            return splitIndex;
+            return firstRightIndex;
         }
 
-        /// @brief Attempts to subdivide a given BVH node.
-        void subdivide(Node &parent)
+        /**
+         * @brief Attempts to split a given BVH node into two children, which are
+         * appended to @c nodes .
+         * @param parallel Whether large nodes may be binned using all available
+         * cores (see @ref reducePrimitives ).
+         * @return Whether the node has been split.
+         */
+        bool split(NodeList &nodes, NodeIndex parentIndex, int depth, bool parallel)
         {
-            // only subdivide if enough children are available.
-            if (parent.primitiveCount <= 2)
+            const Node &parent = nodes[parentIndex];
+
+            // only subdivide if enough children are available, and the
+            // traversal stack is large enough for the children.
+            if (parent.primitiveCount <= 1 || depth >= MaxDepth - 1)
             {
-                return;
+                return false;
             }
 
-            // pick the axis with highest bounding box length as split axis.
-            const int splitAxis = parent.aabb.diagonal().maxComponentIndex();
             const NodeIndex firstPrimitive = parent.firstPrimitiveIndex();
-
-            // set to true when implementing binning
-            static constexpr bool UseSAH = true;
+            const bool exceedsLeafSize = parent.primitiveCount > m_maxLeafSize;
 
             // the point at which to split (note that primitives must be re-ordered
             // so that all children of the left node will have a smaller index than
             // firstRightIndex, and nodes on the right will have an index larger or
             // equal to firstRightIndex)
-            NodeIndex firstRightIndex;
-            if (UseSAH)
+            NodeIndex firstRightIndex = firstPrimitive;
+            if (m_builder == Builder::LBVH)
             {
-                firstRightIndex = binning(parent, splitAxis);
+                firstRightIndex = findMortonSplit(parent);
             }
             else
             {
-                // split in the middle
-                const float splitPos =
-                    parent.aabb.center()[splitAxis]; // pick center of bounding box
-                                                     // as split pos
-
-                // partition algorithm (you might remember this from quicksort)
-                firstRightIndex = firstPrimitive;
-                NodeIndex lastLeftIndex = parent.lastPrimitiveIndex();
-                while (firstRightIndex <= lastLeftIndex)
+                const SplitCandidate best = findObjectSplit(parent, parallel);
+                if (best.cost < Infinity)
                 {
-                    if (getCentroid(
-                            m_primitiveIndices[firstRightIndex])[splitAxis] <
-                        splitPos)
-                    {
-                        firstRightIndex++;
-                    }
-                    else
-                    {
-                        std::swap(m_primitiveIndices[firstRightIndex],
-                                  m_primitiveIndices[lastLeftIndex--]);
-                    }
+                    if (!isSplitWorthwhile(best, parent.aabb, parent.primitiveCount))
+                        return false;
+                    firstRightIndex = partitionPrimitives(parent, best.axis, best.position);
                 }
             }
 
-            const NodeIndex leftCount =
-                firstRightIndex - parent.firstPrimitiveIndex();
-            const NodeIndex rightCount = parent.primitiveCount - leftCount;
+            if (firstRightIndex == firstPrimitive ||
+                firstRightIndex == firstPrimitive + parent.primitiveCount)
+            {
+                // the centroids cannot be separated, so we either create a leaf,
+                // or split the primitives arbitrarily to respect the leaf size
+                if (!exceedsLeafSize)
+                    return false;
+                firstRightIndex = firstPrimitive + parent.primitiveCount / 2;
+            }
 
-            if (leftCount == 0 || rightCount == 0)
+            Node leftChild, rightChild;
+            leftChild.leftFirst = firstPrimitive;
+            leftChild.primitiveCount = firstRightIndex - firstPrimitive;
+            computeAABB(leftChild, parallel);
+            rightChild.leftFirst = firstRightIndex;
+            rightChild.primitiveCount = parent.primitiveCount - leftChild.primitiveCount;
+            computeAABB(rightChild, parallel);
+
+            if (m_builder == Builder::LBVH)
             {
-                // if either child gets no primitives, we abort subdividing
-                return;
+                // the Morton code split ignores the SAH, so the cost of the
+                // split only decides whether to create a leaf instead
+                SplitCandidate candidate;
+                candidate.cost = surfaceArea(leftChild.aabb) * leftChild.primitiveCount +
+                                 surfaceArea(rightChild.aabb) * rightChild.primitiveCount;
+                if (!isSplitWorthwhile(candidate, parent.aabb, parent.primitiveCount))
+                    return false;
             }
 
-            // the two children will always be contiguous in our m_nodes list
-            const NodeIndex leftChildIndex = (NodeIndex)(m_nodes.size() + 0);
-            const NodeIndex rightChildIndex = (NodeIndex)(m_nodes.size() + 1);
-            parent.primitiveCount = 0; // mark the parent node as internal node
-            parent.leftFirst = leftChildIndex;
+            // the two children will always be contiguous in our node list
+            const NodeIndex leftChildIndex = (NodeIndex)nodes.size();
+            nodes[parentIndex].primitiveCount = 0; // mark the parent node as internal node
+            nodes[parentIndex].leftFirst = leftChildIndex;
 
             // `parent' breaks
-            m_nodes.emplace_back();
-            m_nodes[leftChildIndex].leftFirst = firstPrimitive;
-            m_nodes[leftChildIndex].primitiveCount = leftCount;
+            nodes.push_back(leftChild);
+            nodes.push_back(rightChild);
+            return true;
+        }
 
-            m_nodes.emplace_back();
-            m_nodes[rightChildIndex].leftFirst = firstRightIndex;
-            m_nodes[rightChildIndex].primitiveCount = rightCount;
+        /// @brief Recursively subdivides a given BVH node stored in @c nodes .
+        void subdivide(NodeList &nodes, NodeIndex parentIndex, int depth)
+        {
+            // subtrees are built by parallel tasks (or are small), hence never
+            // start threads of their own
+            if (!split(nodes, parentIndex, depth, false))
+                return;
 
             // first, process the left child node (and all of its children)
-            computeAABB(m_nodes[leftChildIndex]);
-            subdivide(m_nodes[leftChildIndex]);
             // then, process the right child node (and all of its children)
-            computeAABB(m_nodes[rightChildIndex]);
-            subdivide(m_nodes[rightChildIndex]);
+            const NodeIndex leftChildIndex = nodes[parentIndex].leftChildIndex();
+            subdivide(nodes, leftChildIndex, depth + 1);
+            subdivide(nodes, leftChildIndex + 1, depth + 1);
         }
 
-    protected:
-        /// @brief Returns the number of children (individual shapes) that are part
-        /// of this acceleration structure.
+        /// @brief A subtree that is built by a single thread.
+        struct BuildTask
+        {
+            /// @brief The root node of the subtree in m_nodes .
+            NodeIndex nodeIndex;
+            /// @brief The depth of the root node of the subtree.
+            int depth;
+        };
+
+        /**
+         * @brief Recursively subdivides the large nodes at the top of the tree
+         * (using parallel binning), and collects all subtrees that are small
+         * enough to be built by a single thread in @c tasks .
+         */
+        void subdivideTopLevels(NodeIndex parentIndex, int depth,
+                                std::vector<BuildTask> &tasks)
+        {
+            if (m_nodes[parentIndex].primitiveCount < ParallelTaskThreshold)
+            {
+                tasks.push_back({parentIndex, depth});
+                return;
+            }
+
+            if (!split(m_nodes, parentIndex, depth, true))
+                return;
+
+            const NodeIndex leftChildIndex = m_nodes[parentIndex].leftChildIndex();
+            subdivideTopLevels(leftChildIndex, depth + 1, tasks);
+            subdivideTopLevels(leftChildIndex + 1, depth + 1, tasks);
+        }
+
+        /**
+         * @brief Builds all subtrees collected by @ref subdivideTopLevels in
+         * parallel, and appends them to m_nodes .
+         * @note Every task subdivides a disjoint range of m_primitiveIndices into
+         * its own node list, hence no synchronization between tasks is needed.
+         * @note Subtrees have no padding node, so the children of their root
+         * node start at index 1, which becomes an even index in m_nodes .
+         */
+        void subdivideTasks(std::vector<BuildTask> tasks)
+        {
+            // start with the largest subtrees for better load balancing
+            std::sort(tasks.begin(), tasks.end(), [&](const BuildTask &a, const BuildTask &b)
+                      { return m_nodes[a.nodeIndex].primitiveCount >
+                               m_nodes[b.nodeIndex].primitiveCount; });
+
+            std::vector<NodeList> subtrees(tasks.size());
+            for_each_parallel(Range(0, int(tasks.size())), [&](int task)
+                              {
+                auto &subtree = subtrees[task];
+                subtree.push_back(m_nodes[tasks[task].nodeIndex]);
+                subdivide(subtree, 0, tasks[task].depth); });
+
+            for (size_t task = 0; task < tasks.size(); task++)
+            {
+                // the root of the subtree replaces the task node, all other nodes
+                // are appended (which shifts their index by offset)
+                const auto &subtree = subtrees[task];
+                const NodeIndex offset = NodeIndex(m_nodes.size()) - 1;
+                for (size_t i = 0; i < subtree.size(); i++)
+                {
+                    Node node = subtree[i];
+                    if (!node.isLeaf())
+                        node.leftFirst += offset;
+
+                    if (i == 0)
+                        m_nodes[tasks[task].nodeIndex] = node;
+                    else
+                        m_nodes.push_back(node);
+                }
+            }
+        }
+
+        /**
+         * @brief The number of levels that are built at once when a ray reaches
+         * a deferred node, which keeps rays from passing through a long chain of
+         * lazily built subtrees with a single split each.
+         */
+        static constexpr int LazyLevels = 4;
+
+        /**
+         * @brief Subdivides a node like @ref subdivide , but defers all of its
+         * descendants with more than @c m_lazyThreshold primitives that are at
+         * least @c LazyLevels below the node (see @ref subdivideLazily ), which
+         * are registered in @c lazy .
+         * @param level The number of levels below the node that is subdivided
+         * lazily (or below the root when building the top of the BVH).
+         * @param parallel Whether large nodes may be binned using all available
+         * cores (see @ref reducePrimitives ).
+         */
+        void subdivideDeferring(NodeList &nodes, LazyNodes &lazy, NodeIndex parentIndex,
+                                int depth, int level, bool parallel)
+        {
+            if (level >= LazyLevels && nodes[parentIndex].primitiveCount > m_lazyThreshold)
+            {
+                lazy.indexOfNode.resize(nodes.size(), -1);
+                lazy.indexOfNode[parentIndex] = int(lazy.nodes.size());
+                LazyNode &lazyNode = *lazy.nodes.emplace_back(std::make_unique<LazyNode>());
+                lazyNode.node = nodes[parentIndex];
+                lazyNode.depth = depth;
+                return;
+            }
+
+            if (!split(nodes, parentIndex, depth, parallel))
+                return;
+
+            const NodeIndex leftChildIndex = nodes[parentIndex].leftChildIndex();
+            subdivideDeferring(nodes, lazy, leftChildIndex, depth + 1, level + 1, parallel);
+            subdivideDeferring(nodes, lazy, leftChildIndex + 1, depth + 1, level + 1, parallel);
+            if (!lazy.nodes.empty())
+                lazy.indexOfNode.resize(nodes.size(), -1);
+        }
+
+        /// @brief Returns whether the given node of a node list is subdivided
+        /// lazily.
+        static bool isDeferred(const LazyNodes &lazy, NodeIndex nodeIndex)
+        {
+            return !lazy.indexOfNode.empty() && lazy.indexOfNode[nodeIndex] >= 0;
+        }
+
+        /**
+         * @brief Returns the subtree of a deferred node, which is built by the
+         * first ray that reaches the node (deferring its large descendants
+         * again, see @ref subdivideDeferring ), while other rays that reach the
+         * node in the meantime wait.
+         * @note Deferred nodes partition disjoint ranges of m_primitiveIndices,
+         * which other rays only read once the node has been built (they wait
+         * until then), hence building them does not conflict with concurrent
+         * traversals, as long as leaves are tested without reading references
+         * of neighbouring leaves (see @ref updateReferences ). The subtree is
+         * built serially, as the calling thread is one of the render threads.
+         */
+        const LazyNode &subdivideLazily(const LazyNodes &lazy, NodeIndex nodeIndex) const
+        {
+            LazyNode &lazyNode = *lazy.nodes[lazy.indexOfNode[nodeIndex]];
+            std::call_once(lazyNode.once, [&]
+                           {
+                // the BVH only appears immutable to users, completing it during
+                // rendering is an implementation detail
+                auto &self = const_cast<AccelerationStructure &>(*this);
+                lazyNode.subtree.push_back(lazyNode.node);
+                lazyNode.subtree.emplace_back(); // padding
+                self.subdivideDeferring(lazyNode.subtree, lazyNode.lazy, 0, lazyNode.depth, 0, false);
+                self.updateReferences(lazyNode.node.firstPrimitiveIndex(), lazyNode.node.primitiveCount);
+                lazyNode.isSubdivided.store(true, std::memory_order_release); });
+            return lazyNode;
+        }
+
+        /**
+         * @brief Re-orders m_nodes into depth-first order, which is the order in
+         * which a serial build creates the nodes (i.e., the children of a node
+         * directly follow the entire subtree of the previous sibling).
+         */
+        void sortNodesDepthFirst()
+        {
+            NodeList sorted;
+            sorted.reserve(m_nodes.size());
+            sorted.push_back(m_nodes[0]);
+            sorted.push_back(m_nodes[1]); // padding
+
+            const auto visit = [&](auto &&self, NodeIndex sortedIndex) -> void
+            {
+                Node &node = sorted[sortedIndex];
+                if (node.isLeaf())
+                    return;
+
+                const NodeIndex leftChildIndex = node.leftChildIndex();
+                node.leftFirst = NodeIndex(sorted.size());
+                sorted.push_back(m_nodes[leftChildIndex + 0]);
+                sorted.push_back(m_nodes[leftChildIndex + 1]);
+                // `node' breaks
+                self(self, sorted[sortedIndex].leftChildIndex());
+                self(self, sorted[sortedIndex].rightChildIndex());
+            };
+            visit(visit, 0);
+
+            m_nodes = std::move(sorted);
+        }
+
+        /**
+         * @brief Re-orders the nodes into treelets: starting from the root, the
+         * children of the node with the largest surface area (i.e., the one most
+         * likely to be traversed) are added to the treelet until it fills a
+         * memory page, and the remaining subtrees start new treelets. The tree
+         * itself is not changed, and children are still stored after their
+         * parent.
+         */
+        void sortNodesTreelets()
+        {
+            // a pair of siblings fills exactly one cache line
+            constexpr int TreeletSize = int(PageSize / CacheLineSize);
+
+            NodeList sorted;
+            sorted.reserve(m_nodes.size());
+            sorted.push_back(m_nodes[0]);
+            sorted.push_back(m_nodes[1]); // padding
+
+            // nodes in `sorted' whose children have not been placed yet, paired
+            // with their surface area
+            typedef std::pair<float, NodeIndex> Candidate;
+            std::vector<NodeIndex> treeletRoots = {0};
+            std::vector<Candidate> frontier;
+            while (!treeletRoots.empty())
+            {
+                const NodeIndex treeletRoot = treeletRoots.back();
+                treeletRoots.pop_back();
+                if (sorted[treeletRoot].isLeaf())
+                    continue;
+
+                frontier.assign(1, {surfaceArea(sorted[treeletRoot].aabb), treeletRoot});
+                for (int pairCount = 0; pairCount < TreeletSize && !frontier.empty(); pairCount++)
+                {
+                    std::pop_heap(frontier.begin(), frontier.end());
+                    const NodeIndex nodeIndex = frontier.back().second;
+                    frontier.pop_back();
+
+                    const NodeIndex leftChildIndex = sorted[nodeIndex].leftChildIndex();
+                    sorted[nodeIndex].leftFirst = NodeIndex(sorted.size());
+                    for (NodeIndex child = 0; child < 2; child++)
+                    {
+                        const Node &childNode = m_nodes[leftChildIndex + child];
+                        sorted.push_back(childNode);
+                        if (childNode.isLeaf())
+                            continue;
+                        frontier.emplace_back(surfaceArea(childNode.aabb),
+                                              NodeIndex(sorted.size()) - 1);
+                        std::push_heap(frontier.begin(), frontier.end());
+                    }
+                }
+
+                // continue with the most likely subtree next, so that it ends up
+                // close to this treelet
+                std::sort(frontier.begin(), frontier.end());
+                for (const Candidate &candidate : frontier)
+                    treeletRoots.push_back(candidate.second);
+            }
+
+            m_nodes = std::move(sorted);
+        }
+
+        /**
+         * @brief Estimates how many cache lines and memory pages a ray that
+         * hits the root node touches during traversal, assuming that a node is
+         * visited with a probability proportional to its surface area.
+         * @note Visiting a node loads the cache line that holds both of its
+         * children. A page is counted whenever the children are stored in a
+         * different page than the node itself.
+         */
+        std::pair<float, float> expectedMemoryTraffic() const
+        {
+            const float rootArea = surfaceArea(rootNode().aabb);
+            if (m_primitiveIndices.empty() || !(rootArea > 0))
+                return {1, 1};
+
+            const auto pageOf = [](NodeIndex nodeIndex)
+            { return nodeIndex * sizeof(Node) / PageSize; };
+
+            float cacheLines = 1;
+            float pages = 1;
+            for (NodeIndex nodeIndex = 0; nodeIndex < NodeIndex(m_nodes.size()); nodeIndex++)
+            {
+                const Node &node = m_nodes[nodeIndex];
+                if (nodeIndex == 1 || node.isLeaf())
+                    continue; // padding and leaves
+
+                const float probability = surfaceArea(node.aabb) / rootArea;
+                cacheLines += probability;
+                if (pageOf(node.leftChildIndex()) != pageOf(nodeIndex))
+                    pages += probability;
+            }
+            return {cacheLines, pages};
+        }
+
+        /**
+         * @brief Spatial splits are only attempted if the overlap of the
+         * children of the best object split is at least this large, relative to
+         * the surface area of the root node (see Stich et al. 2009).
+         */
+        static constexpr float SpatialSplitOverlap = 1e-5f;
+
+        /**
+         * @brief A reference to a primitive for the SBVH builder. References of
+         * primitives that have been split by a spatial split only cover the
+         * part of the primitive on their side of the splitting plane.
+         */
+        struct Reference
+        {
+            /// @brief The bounding box of the referenced part of the primitive.
+            Bounds aabb;
+            /// @brief The index of the primitive.
+            int primitiveIndex;
+        };
+
+        /// @brief Restricts a bounding box to one side of a splitting plane.
+        static Bounds clipToSide(const Bounds &aabb, int axis, float position,
+                                 bool isLeft)
+        {
+            Point lower = aabb.min();
+            Point upper = aabb.max();
+            if (isLeft)
+                upper[axis] = std::min(upper[axis], position);
+            else
+                lower[axis] = std::max(lower[axis], position);
+            return Bounds(lower, upper);
+        }
+
+        /**
+         * @brief Returns whether a bounding box contains at least one point.
+         * @note Unlike @ref Bounds::isEmpty , this also accepts flat boxes (e.g.,
+         * of axis aligned triangles).
+         */
+        static bool containsPoints(const Bounds &aabb)
+        {
+            for (int dim = 0; dim < 3; dim++)
+            {
+                if (!(aabb.min()[dim] <= aabb.max()[dim]))
+                    return false;
+            }
+            return true;
+        }
+
+        /// @brief Finds the best object split for a list of references by
+        /// binning their centroids along all three axes.
+        SplitCandidate findObjectSplit(const std::vector<Reference> &references) const
+        {
+            SplitCandidate best;
+            best.isSpatial = false;
+
+            Bounds centroidBounds = Bounds::empty();
+            for (const Reference &reference : references)
+                centroidBounds.extend(reference.aabb.center());
+
+            const int bins = binCount(references.size());
+            for (int a = 0; a < 3; a++)
+            {
+                const float boundsMin = centroidBounds.min()[a];
+                const float boundsMax = centroidBounds.max()[a];
+                if (boundsMax == boundsMin)
+                    continue;
+
+                Bins axisBins;
+                std::fill_n(axisBins.begin(), bins, Bin{.aabb = Bounds::empty(), .count = 0});
+                const float scale = bins / (boundsMax - boundsMin);
+                for (const Reference &reference : references)
+                {
+                    const int binIndex = min(bins - 1, (int)((reference.aabb.center()[a] - boundsMin) * scale));
+                    axisBins[binIndex].aabb.extend(reference.aabb);
+                    axisBins[binIndex].count++;
+                }
+
+                findBestPlane(axisBins, axisBins, bins, a, boundsMin,
+                              (boundsMax - boundsMin) / bins, best);
+            }
+            return best;
+        }
+
+        /**
+         * @brief Finds the best spatial split for a list of references by
+         * clipping them into equally sized bins along the longest axis of the
+         * node.
+         * @note Entries are counted in the bin a reference starts in, exits in
+         * the bin it ends in.
+         */
+        SplitCandidate findSpatialSplit(const std::vector<Reference> &references,
+                                        const Bounds &aabb) const
+        {
+            SplitCandidate best;
+            best.isSpatial = true;
+
+            const int a = aabb.diagonal().maxComponentIndex();
+            const int bins = binCount(references.size());
+            const float boundsMin = aabb.min()[a];
+            const float binWidth = (aabb.max()[a] - boundsMin) / bins;
+            if (!(binWidth > 0))
+                return best;
+
+            Bins entries, exits;
+            std::fill_n(entries.begin(), bins, Bin{.aabb = Bounds::empty(), .count = 0});
+            std::fill_n(exits.begin(), bins, Bin{.aabb = Bounds::empty(), .count = 0});
+            const auto binOf = [&](float position)
+            {
+                return std::clamp((int)((position - boundsMin) / binWidth), 0, bins - 1);
+            };
+
+            for (const Reference &reference : references)
+            {
+                const int firstBin = binOf(reference.aabb.min()[a]);
+                const int lastBin = binOf(reference.aabb.max()[a]);
+                entries[firstBin].count++;
+                exits[lastBin].count++;
+
+                if (firstBin == lastBin)
+                {
+                    entries[firstBin].aabb.extend(reference.aabb);
+                    continue;
+                }
+                for (int bin = firstBin; bin <= lastBin; bin++)
+                {
+                    // clip the primitive to the slab of this bin
+                    Bounds slab = reference.aabb;
+                    if (bin > firstBin)
+                        slab = clipToSide(slab, a, boundsMin + bin * binWidth, false);
+                    if (bin < lastBin)
+                        slab = clipToSide(slab, a, boundsMin + (bin + 1) * binWidth, true);
+                    entries[bin].aabb.extend(
+                        getClippedBoundingBox(reference.primitiveIndex, slab));
+                }
+            }
+
+            findBestPlane(entries, exits, bins, a, boundsMin, binWidth, best);
+            return best;
+        }
+
+        /**
+         * @brief Sweeps over the planes between bins and records the one with the
+         * lowest SAH cost in @c best .
+         * @param left The bins whose counts contribute to the left child.
+         * @param right The bins whose counts contribute to the right child (for
+         * object splits, this is the same as @c left ).
+         * @param bins The number of bins that are used.
+         * @param axis The axis along which the bins are laid out.
+         * @note The bounding boxes are always taken from @c left .
+         */
+        void findBestPlane(const Bins &left, const Bins &right, int bins, int axis,
+                           float boundsMin, float binWidth, SplitCandidate &best) const
+        {
+            Bounds leftBoxes[MaxBins - 1];
+            int leftCount[MaxBins - 1];
+            Bounds leftBox = Bounds::empty();
+            int leftSum = 0;
+            for (int i = 0; i < bins - 1; i++)
+            {
+                leftSum += left[i].count;
+                leftBox.extend(left[i].aabb);
+                leftCount[i] = leftSum;
+                leftBoxes[i] = leftBox;
+            }
+
+            Bounds rightBox = Bounds::empty();
+            int rightSum = 0;
+            for (int i = bins - 2; i >= 0; i--)
+            {
+                rightSum += right[i + 1].count;
+                rightBox.extend(left[i + 1].aabb);
+                if (leftCount[i] == 0 || rightSum == 0)
+                    continue;
+
+                const float cost = leftCount[i] * surfaceArea(leftBoxes[i]) +
+                                   rightSum * surfaceArea(rightBox);
+                if (cost < best.cost)
+                {
+                    best.cost = cost;
+                    best.axis = axis;
+                    best.position = boundsMin + binWidth * (i + 1);
+                    best.left = leftBoxes[i];
+                    best.right = rightBox;
+                }
+            }
+        }
+
+        /**
+         * @brief Distributes references to the children of a split. References
+         * straddling a spatial split are duplicated as long as the duplication
+         * budget allows it, and are otherwise assigned to the side their
+         * centroid lies on.
+         */
+        void partitionReferences(std::vector<Reference> &references,
+                                 const SplitCandidate &split, int &budget,
+                                 std::vector<Reference> &left,
+                                 std::vector<Reference> &right) const
+        {
+            const int a = split.axis;
+            for (const Reference &reference : references)
+            {
+                if (!split.isSpatial)
+                {
+                    (reference.aabb.center()[a] < split.position ? left : right)
+                        .push_back(reference);
+                    continue;
+                }
+
+                if (reference.aabb.max()[a] <= split.position)
+                {
+                    left.push_back(reference);
+                }
+                else if (reference.aabb.min()[a] >= split.position)
+                {
+                    right.push_back(reference);
+                }
+                else if (budget > 0)
+                {
+                    const Bounds leftPart = getClippedBoundingBox(
+                        reference.primitiveIndex,
+                        clipToSide(reference.aabb, a, split.position, true));
+                    const Bounds rightPart = getClippedBoundingBox(
+                        reference.primitiveIndex,
+                        clipToSide(reference.aabb, a, split.position, false));
+                    // clipping might reveal that the primitive only touches
+                    // the plane, in which case no duplicate is needed
+                    if (!containsPoints(leftPart) && !containsPoints(rightPart))
+                    {
+                        (reference.aabb.center()[a] < split.position ? left : right)
+                            .push_back(reference);
+                    }
+                    else if (!containsPoints(rightPart))
+                    {
+                        left.push_back({leftPart, reference.primitiveIndex});
+                    }
+                    else if (!containsPoints(leftPart))
+                    {
+                        right.push_back({rightPart, reference.primitiveIndex});
+                    }
+                    else
+                    {
+                        left.push_back({leftPart, reference.primitiveIndex});
+                        right.push_back({rightPart, reference.primitiveIndex});
+                        budget--;
+                    }
+                }
+                else
+                {
+                    (reference.aabb.center()[a] < split.position ? left : right)
+                        .push_back(reference);
+                }
+            }
+
+            // the references of the parent are no longer needed
+            std::vector<Reference>().swap(references);
+        }
+
+        /**
+         * @brief Recursively subdivides a node of the SBVH, whose references
+         * are given by @c references . Leaves append their references to
+         * m_primitiveIndices .
+         */
+        void subdivideSpatial(NodeIndex nodeIndex, std::vector<Reference> references,
+                              int depth, float rootArea, int &budget)
+        {
+            Bounds aabb = Bounds::empty();
+            for (const Reference &reference : references)
+                aabb.extend(reference.aabb);
+            m_nodes[nodeIndex].aabb = aabb;
+
+            std::vector<Reference> left, right;
+            const bool canSplit = references.size() > 1 && depth < MaxDepth - 1;
+            if (canSplit)
+            {
+                SplitCandidate split = findObjectSplit(references);
+
+                // spatial splits only pay off if the children of the object
+                // split overlap significantly
+                const Bounds overlap(elementwiseMax(split.left.min(), split.right.min()),
+                                     elementwiseMin(split.left.max(), split.right.max()));
+                const bool overlaps = split.cost < Infinity && containsPoints(overlap) &&
+                                      surfaceArea(overlap) > SpatialSplitOverlap * rootArea;
+                if (budget > 0 && (split.cost == Infinity || overlaps))
+                {
+                    const SplitCandidate spatialSplit = findSpatialSplit(references, aabb);
+                    if (spatialSplit.cost < split.cost)
+                        split = spatialSplit;
+                }
+
+                if (split.cost < Infinity && isSplitWorthwhile(split, aabb, references.size()))
+                    partitionReferences(references, split, budget, left, right);
+            }
+
+            if (left.empty() || right.empty())
+            {
+                references.insert(references.end(), left.begin(), left.end());
+                references.insert(references.end(), right.begin(), right.end());
+                left.clear();
+                right.clear();
+            }
+
+            if (canSplit && left.empty() && references.size() > size_t(m_maxLeafSize))
+            {
+                // the references cannot be separated, so we split them
+                // arbitrarily to respect the leaf size
+                const auto middle = references.begin() + references.size() / 2;
+                left.assign(references.begin(), middle);
+                right.assign(middle, references.end());
+            }
+
+            if (left.empty() || right.empty())
+            {
+                // create a leaf node
+                m_nodes[nodeIndex].leftFirst = NodeIndex(m_primitiveIndices.size());
+                m_nodes[nodeIndex].primitiveCount = NodeIndex(references.size());
+                for (const Reference &reference : references)
+                    m_primitiveIndices.push_back(reference.primitiveIndex);
+                return;
+            }
+
+            // the two children will always be contiguous in our node list
+            const NodeIndex leftChildIndex = NodeIndex(m_nodes.size());
+            m_nodes[nodeIndex].primitiveCount = 0; // mark the node as internal node
+            m_nodes[nodeIndex].leftFirst = leftChildIndex;
+            m_nodes.emplace_back();
+            m_nodes.emplace_back();
+
+            subdivideSpatial(leftChildIndex, std::move(left), depth + 1, rootArea, budget);
+            subdivideSpatial(leftChildIndex + 1, std::move(right), depth + 1, rootArea, budget);
+        }
+
+        /**
+         * @brief Builds the BVH with spatial splits (Stich et al. 2009, "Spatial
+         * Splits in Bounding Volume Hierarchies"). Primitives can be referenced
+         * by multiple leaves, hence m_primitiveIndices may contain duplicates.
+         */
+        void buildSpatialSplits()
+        {
+            std::vector<Reference> references;
+            references.reserve(numberOfPrimitives());
+            for (int i = 0; i < numberOfPrimitives(); i++)
+            {
+                const Bounds aabb = getBoundingBox(i);
+                if (canBeHit(i) && containsPoints(aabb))
+                    references.push_back({aabb, i});
+            }
+
+            // create root node
+            m_nodes.emplace_back();
+            m_nodes.emplace_back(); // padding
+
+            Bounds rootBounds = Bounds::empty();
+            for (const Reference &reference : references)
+                rootBounds.extend(reference.aabb);
+
+            const int totalBudget = int(m_duplicationBudget * numberOfPrimitives());
+            int budget = totalBudget;
+            subdivideSpatial(0, std::move(references), 0, surfaceArea(rootBounds), budget);
+
+            logger(EInfo, "spatial splits created %d additional references",
+                   totalBudget - budget);
+        }
+
+        /**
+         * @brief Builds the BVH with object splits only, using all available
+         * cores. Depending on the builder, nodes are either split using the SAH,
+         * or by the Morton codes of the primitives.
+         */
+        void buildObjectSplits()
+        {
+            m_primitiveBounds.resize(numberOfPrimitives());
+            m_primitiveCentroids.resize(numberOfPrimitives());
+            const auto cachePrimitives = [&](Range chunk)
+            {
+                for (int i : chunk)
+                {
+                    m_primitiveBounds[i] = getBoundingBox(i);
+                    m_primitiveCentroids[i] = getCentroid(i);
+                }
+            };
+            // small structures (e.g., most groups and meshes) are not worth
+            // starting threads for
+            if (numberOfPrimitives() < ParallelBinningThreshold)
+                cachePrimitives(Range(0, numberOfPrimitives()));
+            else
+                for_each_parallel(ChunkedRange(0, numberOfPrimitives(), ParallelChunkSize), cachePrimitives);
+
+            // fill primitive indices with 0 to primitiveCount - 1, except for
+            // children that cannot be hit (including empty children, e.g.,
+            // groups without shapes, whose centroid is undefined)
+            m_primitiveIndices.resize(numberOfPrimitives());
+            std::iota(m_primitiveIndices.begin(), m_primitiveIndices.end(), 0);
+            std::erase_if(m_primitiveIndices, [&](int primitiveIndex)
+                          { return !canBeHit(primitiveIndex) || !containsPoints(m_primitiveBounds[primitiveIndex]); });
+
+            // create root node
+            auto &root = m_nodes.emplace_back();
+            root.leftFirst = 0;
+            root.primitiveCount = NodeIndex(m_primitiveIndices.size());
+            computeAABB(root, true);
+            // `root' breaks
+            m_nodes.emplace_back(); // padding
+
+            if (m_builder == Builder::LBVH)
+                sortByMortonCodes();
+
+            if (m_lazyThreshold > 0)
+            {
+                // the caches (and Morton codes) are kept for the nodes that are
+                // subdivided later on
+                subdivideDeferring(m_nodes, m_lazyNodes, 0, 0, 0, true);
+                return;
+            }
+
+            // split the top of the tree on this thread, and build the remaining
+            // subtrees in parallel
+            std::vector<BuildTask> tasks;
+            subdivideTopLevels(0, 0, tasks);
+            if (tasks.size() == 1 && tasks.front().nodeIndex == 0)
+            {
+                // the entire tree is small enough to be built serially
+                subdivide(m_nodes, 0, 0);
+            }
+            else
+            {
+                subdivideTasks(std::move(tasks));
+                // makes the result identical to that of a serial build
+                sortNodesDepthFirst();
+            }
+
+            if (m_builder == Builder::LBVH)
+            {
+                m_mortonCodes.clear();
+                m_mortonCodes.shrink_to_fit();
+                // the root of an empty BVH would be mistaken for an internal node
+                if (m_optimizeTreelets && !m_primitiveIndices.empty())
+                    optimizeTreelets();
+            }
+
+            m_primitiveBounds.clear();
+            m_primitiveBounds.shrink_to_fit();
+            m_primitiveCentroids.clear();
+            m_primitiveCentroids.shrink_to_fit();
+        }
+
+        /**
+         * @brief For the LBVH builder: Sorts m_primitiveIndices by the Morton
+         * codes of the centroids (relative to the bounds of all centroids), and
+         * stores the sorted codes in m_mortonCodes .
+         */
+        void sortByMortonCodes()
+        {
+            const NodeIndex count = NodeIndex(m_primitiveIndices.size());
+            const Bounds centroidBounds = reducePrimitives(
+                0, count, Bounds::empty(),
+                [&](Bounds &aabb, int primitiveIndex)
+                { aabb.extend(primitiveCentroid(primitiveIndex)); },
+                [](Bounds &aabb, const Bounds &other) { aabb.extend(other); }, true);
+
+            // scale maps centroids to the integer grid of the Morton curve, and
+            // is 0 for axes along which all centroids coincide
+            constexpr float GridSize = float(1 << MortonBits);
+            float scale[3];
+            for (int dim = 0; dim < 3; dim++)
+            {
+                const float extent = centroidBounds.max()[dim] - centroidBounds.min()[dim];
+                scale[dim] = extent > 0 ? GridSize / extent : 0;
+            }
+
+            m_mortonCodes.resize(count);
+            const auto encodeChunk = [&](Range chunk)
+            {
+                for (int i : chunk)
+                {
+                    const Point centroid = primitiveCentroid(m_primitiveIndices[i]);
+                    uint32_t cell[3];
+                    for (int dim = 0; dim < 3; dim++)
+                    {
+                        // written so that NaNs (e.g., of unbounded shapes) map to 0
+                        const float offset = (centroid[dim] - centroidBounds.min()[dim]) * scale[dim];
+                        cell[dim] = offset > 0 ? uint32_t(std::min(offset, GridSize - 1)) : 0;
+                    }
+                    m_mortonCodes[i] = mortonCode(cell[0], cell[1], cell[2]);
+                }
+            };
+            if (count < ParallelBinningThreshold)
+                encodeChunk(Range(0, count));
+            else
+                for_each_parallel(ChunkedRange(0, count, ParallelChunkSize), encodeChunk);
+
+            radixSort(m_mortonCodes, m_primitiveIndices, 3 * MortonBits);
+        }
+
+        /// @brief The largest number of leaves of the treelets restructured by
+        /// @ref optimizeTreelets .
+        static constexpr int OptimizedTreeletSize = 7;
+
+        /**
+         * @brief Improves the topology of the BVH by restructuring treelets
+         * (small subtrees with up to @c OptimizedTreeletSize leaves) so that the
+         * surface area of their internal nodes is minimal (Karras and Aila,
+         * "Fast Parallel Construction of High-Quality Bounding Volume
+         * Hierarchies"). Starting from the root, a treelet is formed by
+         * repeatedly expanding its leaf with the largest surface area, and its
+         * leaves become the roots of the next treelets.
+         * @note Restructuring re-uses the nodes of the treelet, hence the nodes
+         * are sorted depth-first afterwards so that children are again stored
+         * after their parent.
+         */
+        void optimizeTreelets()
+        {
+            constexpr int SubsetCount = 1 << OptimizedTreeletSize;
+            Timer optimizeTimer;
+
+            // the height of every subtree, which ensures that no leaf ends up
+            // deeper than the traversal stack allows
+            std::vector<int> heights(m_nodes.size(), 0);
+            for (NodeIndex i = NodeIndex(m_nodes.size()) - 1; i >= 0; i--)
+            {
+                if (i != 1 && !m_nodes[i].isLeaf())
+                    heights[i] = 1 + std::max(heights[m_nodes[i].leftChildIndex()],
+                                              heights[m_nodes[i].rightChildIndex()]);
+            }
+
+            int restructuredCount = 0;
+            std::vector<std::pair<NodeIndex, int>> roots = {{0, 0}};
+            while (!roots.empty())
+            {
+                const auto [rootIndex, rootDepth] = roots.back();
+                roots.pop_back();
+                if (m_nodes[rootIndex].isLeaf())
+                    continue;
+
+                // form the treelet, where every expanded node contributes the
+                // pair of slots of its children
+                NodeIndex leaves[OptimizedTreeletSize];
+                int leafDepths[OptimizedTreeletSize];
+                NodeIndex pairs[OptimizedTreeletSize - 1];
+                int leafCount = 0, pairCount = 0;
+                float originalCost = surfaceArea(m_nodes[rootIndex].aabb);
+                pairs[pairCount++] = m_nodes[rootIndex].leftChildIndex();
+                for (int i = 0; i < 2; i++)
+                {
+                    leaves[leafCount] = pairs[0] + i;
+                    leafDepths[leafCount++] = rootDepth + 1;
+                }
+                while (leafCount < OptimizedTreeletSize)
+                {
+                    int largest = -1;
+                    float largestArea = -1;
+                    for (int i = 0; i < leafCount; i++)
+                    {
+                        const Node &node = m_nodes[leaves[i]];
+                        if (!node.isLeaf() && surfaceArea(node.aabb) > largestArea)
+                        {
+                            largest = i;
+                            largestArea = surfaceArea(node.aabb);
+                        }
+                    }
+                    if (largest < 0)
+                        break;
+
+                    originalCost += largestArea;
+                    const NodeIndex children = m_nodes[leaves[largest]].leftChildIndex();
+                    pairs[pairCount++] = children;
+                    leaves[largest] = children;
+                    leaves[leafCount] = children + 1;
+                    leafDepths[largest]++;
+                    leafDepths[leafCount++] = leafDepths[largest];
+                }
+
+                // find the topology with the smallest cost for every subset of
+                // leaves, where subsets are visited after all of their subsets
+                Node leafNodes[OptimizedTreeletSize];
+                int leafHeights[OptimizedTreeletSize];
+                for (int i = 0; i < leafCount; i++)
+                {
+                    leafNodes[i] = m_nodes[leaves[i]];
+                    leafHeights[i] = heights[leaves[i]];
+                }
+
+                const int fullSet = (1 << leafCount) - 1;
+                Bounds bounds[SubsetCount];
+                float cost[SubsetCount];
+                int leftSet[SubsetCount];
+                for (int set = 1; set <= fullSet; set++)
+                {
+                    const int lowest = set & -set;
+                    const int remainder = set ^ lowest;
+                    bounds[set] = leafNodes[std::countr_zero(unsigned(lowest))].aabb;
+                    if (remainder == 0)
+                    {
+                        cost[set] = 0; // the cost of the leaves does not change
+                        continue;
+                    }
+                    bounds[set].extend(bounds[remainder]);
+
+                    // only consider partitions where the lowest leaf is on the
+                    // left, as mirrored partitions have the same cost
+                    float bestCost = Infinity;
+                    for (int subset = (remainder - 1) & remainder;; subset = (subset - 1) & remainder)
+                    {
+                        const int left = lowest | subset;
+                        const float partitionCost = cost[left] + cost[set ^ left];
+                        if (partitionCost < bestCost)
+                        {
+                            bestCost = partitionCost;
+                            leftSet[set] = left;
+                        }
+                        if (subset == 0)
+                            break;
+                    }
+                    cost[set] = surfaceArea(bounds[set]) + bestCost;
+                }
+
+                const auto fitsStack = [&](auto &&self, int set, int depth) -> bool
+                {
+                    if ((set & (set - 1)) == 0)
+                        return depth + leafHeights[std::countr_zero(unsigned(set))] < MaxDepth;
+                    return self(self, leftSet[set], depth + 1) &&
+                           self(self, set ^ leftSet[set], depth + 1);
+                };
+
+                if (!(cost[fullSet] < originalCost * (1 - 1e-5f)) ||
+                    !fitsStack(fitsStack, fullSet, rootDepth))
+                {
+                    // keep the treelet as it is
+                    for (int i = 0; i < leafCount; i++)
+                        roots.emplace_back(leaves[i], leafDepths[i]);
+                    continue;
+                }
+
+                // rebuild the treelet in its own slots, the root keeps its index
+                int nextPair = 0;
+                const auto rebuild = [&](auto &&self, int set, NodeIndex index, int depth) -> void
+                {
+                    if ((set & (set - 1)) == 0)
+                    {
+                        const int leaf = std::countr_zero(unsigned(set));
+                        m_nodes[index] = leafNodes[leaf];
+                        heights[index] = leafHeights[leaf];
+                        roots.emplace_back(index, depth);
+                        return;
+                    }
+
+                    const NodeIndex children = pairs[nextPair++];
+                    m_nodes[index].aabb = bounds[set];
+                    m_nodes[index].leftFirst = children;
+                    m_nodes[index].primitiveCount = 0;
+                    self(self, leftSet[set], children, depth + 1);
+                    self(self, set ^ leftSet[set], children + 1, depth + 1);
+                };
+                rebuild(rebuild, fullSet, rootIndex, rootDepth);
+                restructuredCount++;
+            }
+
+            sortNodesDepthFirst();
+            logger(EInfo, "restructured %d treelets in %.1f ms", restructuredCount,
+                   optimizeTimer.getElapsedTime() * 1000);
+        }
+
+    protected:
+        /**
+         * @brief Reads the configuration of the acceleration structure:
+         * - @c bvh -- the algorithm used to build the BVH, either @c "sah"
+         * (default), @c "sbvh" , which also considers spatial splits, or
+         * @c "lbvh" , which sorts primitives along a Morton curve and builds
+         * several times faster at the cost of slower traversal. Note that
+         * spatial splits can cause a primitive to be tested multiple times by
+         * the same ray, which re-rolls stochastic alpha masks.
+         * - @c optimizeTreelets -- for @c "lbvh" : whether to restructure small
+         * subtrees after the build to reduce their SAH cost (default true).
+         * - @c duplicationBudget -- for @c "sbvh" : how many references may be
+         * created by splitting primitives, relative to the number of primitives
+         * (default 0.3).
+         * - @c maxBins -- the largest number of bins per axis used to find
+         * splits (default 32, at most 64). Smaller nodes use fewer bins.
+         * - @c traversalCost and @c intersectionCost -- the SAH costs of
+         * traversing a node and intersecting a primitive (default 1 each),
+         * which decide whether splitting a node pays off.
+         * - @c maxLeafSize -- nodes with more primitives are always split
+         * (default 8).
+         * - @c bvhLayout -- the node layout used for traversal, either
+         * @c "binary" (default), @c "bvh4" , @c "bvh8" , or their variants
+         * @c "bvh4-quantized" and @c "bvh8-quantized" , whose nodes take half
+         * the memory.
+         * - @c nodeOrder -- how the nodes are laid out in memory, either
+         * @c "depthfirst" (default) or @c "treelet" , which clusters subtrees
+         * that are likely to be traversed together into memory pages.
+         * - @c update -- how the BVH follows animated geometry, either
+         * @c "refit" (default), which is fast but degrades the quality of the
+         * tree for large motions, or @c "rebuild" .
+         * - @c lazyThreshold -- nodes with more primitives are only subdivided
+         * once a ray first reaches them (default 0, which builds the entire BVH
+         * up front). This reduces the time to the first pixel for large assets
+         * of which only parts are ever hit, and requires the binary layout in
+         * depth-first order with object splits (treelets are not optimized).
+         * Lazy BVHs are rebuilt instead of refit for animations.
+         */
+        AccelerationStructure(const Properties &properties)
+        {
+            m_builder = properties.getEnum<Builder>("bvh", Builder::SAH,
+                                                    {
+                                                        {"sah", Builder::SAH},
+                                                        {"sbvh", Builder::SBVH},
+                                                        {"lbvh", Builder::LBVH},
+                                                    });
+            m_optimizeTreelets = properties.get<bool>("optimizeTreelets", true);
+            m_duplicationBudget = properties.get<float>("duplicationBudget", 0.3f);
+            m_maxBins = std::clamp(properties.get<int>("maxBins", 32), MinBins, MaxBins);
+            m_traversalCost = properties.get<float>("traversalCost", 1.f);
+            m_intersectionCost = properties.get<float>("intersectionCost", 1.f);
+            m_maxLeafSize = std::max(properties.get<int>("maxLeafSize", 8), 1);
+            m_layout = properties.getEnum<Layout>("bvhLayout", Layout::Binary,
+                                                  {
+                                                      {"binary", Layout::Binary},
+                                                      {"bvh4", Layout::BVH4},
+                                                      {"bvh8", Layout::BVH8},
+                                                      {"bvh4-quantized", Layout::BVH4Quantized},
+                                                      {"bvh8-quantized", Layout::BVH8Quantized},
+                                                  });
+            m_nodeOrder = properties.getEnum<NodeOrder>("nodeOrder", NodeOrder::DepthFirst,
+                                                        {
+                                                            {"depthfirst", NodeOrder::DepthFirst},
+                                                            {"treelet", NodeOrder::Treelet},
+                                                        });
+            m_update = properties.getEnum<Update>("update", Update::Refit,
+                                                  {
+                                                      {"refit", Update::Refit},
+                                                      {"rebuild", Update::Rebuild},
+                                                  });
+            m_lazyThreshold = std::max(properties.get<int>("lazyThreshold", 0), 0);
+            if (m_lazyThreshold > 0 && (m_layout != Layout::Binary || m_nodeOrder != NodeOrder::DepthFirst ||
+                                        m_builder == Builder::SBVH))
+                lightwave_throw("lazy BVHs require the binary layout in depth-first order, and object splits");
+            if (m_lazyThreshold > 0)
+                m_lazyThreshold = std::max(m_lazyThreshold, m_maxLeafSize);
+        }
+
+        /// @brief Returns the number of children (individual shapes) that are part
+        /// of this acceleration structure.
         virtual int numberOfPrimitives() const = 0;
         /// @brief Intersect a single child (identified by the index) with the given
         /// ray.
         virtual bool intersect(int primitiveIndex, const Ray &ray,
                                Intersection &its, Sampler &rng) const = 0;
+        /**
+         * @brief Tests whether a single child blocks the given ray before
+         * @c its.t , without populating the hit (see @ref Shape::occluded ).
+         * By default, this performs a regular intersection.
+         */
+        virtual bool occluded(int primitiveIndex, const Ray &ray,
+                              Intersection &its, Sampler &rng) const
+        {
+            return intersect(primitiveIndex, ray, its, rng);
+        }
+        /**
+         * @brief Returns whether the given child can be hit at all, children
+         * that cannot (e.g., triangles that an alpha mask renders fully
+         * transparent) are left out of the BVH.
+         */
+        virtual bool canBeHit(int primitiveIndex) const { return true; }
+        /// @brief Returns the kinds of rays that can hit the given child (see
+        /// @ref Shape::visibility ).
+        virtual uint8_t primitiveVisibility(int primitiveIndex) const { return AllRayTypes; }
+        /**
+         * @brief Returns the SAH cost of intersecting a child relative to the
+         * @c intersectionCost property, for children that are more expensive
+         * to test than a single primitive (e.g., clusters of triangles).
+         */
+        virtual float relativeIntersectionCost() const { return 1; }
         /// @brief Returns the axis aligned bounding box of the given child.
         virtual Bounds getBoundingBox(int primitiveIndex) const = 0;
         /// @brief Returns the centroid of the given child.
         virtual Point getCentroid(int primitiveIndex) const = 0;
+        /**
+         * @brief Returns the bounding box of the part of the given child that
+         * lies within @c clip (used for spatial splits). By default, this clips
+         * the bounding box of the child, but shapes can provide tighter bounds.
+         */
+        virtual Bounds getClippedBoundingBox(int primitiveIndex,
+                                             const Bounds &clip) const
+        {
+            return clip.clip(getBoundingBox(primitiveIndex));
+        }
+
+        /**
+         * @brief Updates the children to the given frame of an animation (see
+         * @ref Shape::setFrame ), and returns whether any of them changed. The
+         * BVH is updated afterwards if necessary.
+         */
+        virtual bool updateFrame(int frame) { return false; }
+
+        /**
+         * @brief Traverses the BVH like @ref intersect (or like @ref occluded if
+         * @c AnyHit is set), but tests the children of each leaf at once
+         * through the given function (e.g., with SIMD instructions).
+         * @param testLeaf Called as @code testLeaf(first, count) @endcode for
+         * every leaf that might contain a hit, where the children of the leaf
+         * are the references @c first to @c first + count - 1 (see
+         * @ref referencedPrimitive ), and returns whether a hit has been found
+         * (updating @c its.t ). With @c AnyHit set, it may return after the
+         * first hit.
+         */
+        template <bool AnyHit, typename TestLeaf>
+        bool intersectLeaves(const Ray &ray, Intersection &its, TestLeaf &&testLeaf) const
+        {
+            if (m_primitiveIndices.empty())
+                return false; // exit early if no children exist
+
+            if (TraversalRecorder *recorder = TraversalRecorder::active())
+                return recorder->record(this, its, [&]
+                                        { return traverse<AnyHit>(ray, its, testLeaf); });
+            return traverse<AnyHit>(ray, its, testLeaf);
+        }
+
+        /**
+         * @brief Traverses the BVH like @ref intersect (or like @ref occluded if
+         * @c AnyHit is set), but tests the children through the given function
+         * instead of the virtual @ref intersect(int, const Ray &, Intersection &, Sampler &) .
+         * Shapes that are declared @c final can pass a function that calls
+         * their own test directly, which allows the compiler to inline it into
+         * the leaf loops.
+         * @param testReference Called as @code testReference(reference) @endcode
+         * for every child that might be hit, where @c reference is the position
+         * of the child in the leaves of the BVH (see @ref referencedPrimitive ),
+         * and returns whether it has been hit (updating @c its.t ).
+         */
+        template <bool AnyHit, typename TestReference>
+        bool intersectPrimitives(const Ray &ray, Intersection &its,
+                                 TestReference &&testReference) const
+        {
+            return intersectLeaves<AnyHit>(ray, its, [&](NodeIndex first, NodeIndex count)
+                                           {
+                bool wasIntersected = false;
+                for (NodeIndex reference = first; reference < first + count; reference++)
+                {
+                    if constexpr (AnyHit)
+                    {
+                        if (testReference(reference))
+                            return true;
+                    }
+                    else
+                    {
+                        wasIntersected |= testReference(reference);
+                    }
+                }
+                return wasIntersected; });
+        }
+
+        /**
+         * @brief Traverses the BVH once for a packet of rays to find their
+         * closest hits, with the same results as @ref intersectLeaves for each
+         * ray (see @ref intersectPacketNodes ).
+         * @param testLeaf Called as @code testLeaf(first, count, rays) @endcode
+         * with the rays of the packet that might hit the children of the leaf,
+         * and returns the rays that have been hit (updating their @c its.t ).
+         */
+        template <typename TestLeaf>
+        RayMask intersectLeavesPacket(const Ray *rays, Intersection *its, RayMask active,
+                                      TestLeaf &&testLeaf) const
+        {
+            if (m_primitiveIndices.empty())
+                return 0;
+
+            if (m_layout == Layout::Binary && m_lazyThreshold == 0 && !TraversalRecorder::active())
+                return intersectPacketNodes(rays, its, active, testLeaf);
+
+            // other layouts are traversed one ray at a time
+            RayMask hits = 0;
+            for (RayMask remaining = active; remaining; remaining &= remaining - 1)
+            {
+                const int index = std::countr_zero(remaining);
+                const RayMask ray = RayMask(1) << index;
+                if (intersectLeaves<false>(rays[index], its[index], [&](NodeIndex first, NodeIndex count)
+                                           { return testLeaf(first, count, ray) != 0; }))
+                    hits |= ray;
+            }
+            return hits;
+        }
+
+        /// @brief Returns the number of references to children in the leaves of
+        /// the BVH (which can exceed the number of children for spatial splits).
+        int referenceCount() const { return int(m_primitiveIndices.size()); }
+
+        /**
+         * @brief Returns the index of the child at the given position in the
+         * leaves of the BVH. Leaves cover contiguous ranges of references, hence
+         * data stored per reference is traversed in order.
+         */
+        int referencedPrimitive(int reference) const { return m_primitiveIndices[reference]; }
+
+        /**
+         * @brief Called whenever the BVH has been built or refitted, so that
+         * shapes can update data they store per reference (see
+         * @ref referencedPrimitive ).
+         * @note Lazily subdivided nodes re-order their references during
+         * rendering, and then only update the range of their references, while
+         * other threads might read the remaining references. Hence testing a
+         * leaf must never read data of references outside of it (e.g., by
+         * loading full SIMD packets past its end), even if it is discarded.
+         */
+        virtual void updateReferences(int first, int count) {}
 
         /// @brief Builds the acceleration structure.
         void buildAccelerationStructure()
         {
             Timer buildTimer;
 
-            // fill primitive indices with 0 to primitiveCount - 1
-            m_primitiveIndices.resize(numberOfPrimitives());
-            std::iota(m_primitiveIndices.begin(), m_primitiveIndices.end(), 0);
+            // discard the previous BVH when rebuilding
+            m_nodes.clear();
+            m_primitiveIndices.clear();
+            m_lazyNodes = {};
+            m_bvh4.clear();
+            m_bvh8.clear();
+            m_qbvh4.clear();
+            m_qbvh8.clear();
 
-            // create root node
-            auto &root = m_nodes.emplace_back();
-            root.leftFirst = 0;
-            root.primitiveCount = numberOfPrimitives();
-            computeAABB(root);
-            subdivide(root);
+            if (m_builder == Builder::SBVH)
+                buildSpatialSplits();
+            else
+                buildObjectSplits();
+
+            if (m_primitiveIndices.empty())
+            {
+                // the root is an empty leaf (which traversal never visits), and
+                // would be mistaken for an internal node by the passes below
+                m_nodeVisibility.clear();
+                updateReferences(0, 0);
+                return;
+            }
+
+            if (m_nodeOrder == NodeOrder::Treelet)
+                sortNodesTreelets();
+            computeNodeVisibility();
 
             logger(EInfo, "built BVH with %ld nodes for %ld primitives in %.1f ms",
-                   m_nodes.size(), numberOfPrimitives(),
+                   m_nodes.size() - 1, numberOfPrimitives(),
                    buildTimer.getElapsedTime() * 1000);
+
+            const auto [cacheLines, pages] = expectedMemoryTraffic();
+            logger(EDebug, "expected cache lines touched per ray: %.2f (in %.2f pages)",
+                   cacheLines, pages);
+
+            const size_t binaryMemory = m_nodes.size() * sizeof(Node);
+            if (m_layout != Layout::Binary)
+                collapseAccelerationStructure();
+
+            const size_t nodeMemory = m_layout == Layout::Binary
+                                          ? binaryMemory
+                                          : visitWideBVH([](const auto &bvh)
+                                                         { return bvh.memoryUsage(); });
+            logger(EInfo, "BVH memory: %.2f MiB for nodes (%.0f%% of the binary layout), "
+                          "%.2f MiB for primitive indices",
+                   nodeMemory / 1048576.0, 100.0 * nodeMemory / binaryMemory,
+                   m_primitiveIndices.size() * sizeof(int) / 1048576.0);
+
+            updateReferences(0, referenceCount());
+        }
+
+        /**
+         * @brief Computes m_nodeVisibility bottom-up from the visibility of the
+         * primitives, or leaves it empty if all primitives can be hit by all
+         * rays (so that traversal does not need to check it).
+         * @note Deferred nodes of lazy builds act as leaves, their subtrees are
+         * only pruned at the level of the primitives.
+         */
+        void computeNodeVisibility()
+        {
+            m_nodeVisibility.clear();
+            bool isVisible = true;
+            for (int primitiveIndex = 0; primitiveIndex < numberOfPrimitives() && isVisible; primitiveIndex++)
+                isVisible = primitiveVisibility(primitiveIndex) == AllRayTypes;
+            if (isVisible)
+                return;
+
+            m_nodeVisibility.assign(m_nodes.size(), 0);
+            // children are always stored after their parent, hence iterating
+            // backwards visits children before their parents
+            for (NodeIndex nodeIndex = NodeIndex(m_nodes.size()) - 1; nodeIndex >= 0; nodeIndex--)
+            {
+                if (nodeIndex == 1)
+                    continue; // padding
+
+                const Node &node = m_nodes[nodeIndex];
+                uint8_t &visibility = m_nodeVisibility[nodeIndex];
+                if (node.isLeaf())
+                {
+                    for (NodeIndex reference = node.firstPrimitiveIndex();
+                         reference <= node.lastPrimitiveIndex(); reference++)
+                        visibility |= primitiveVisibility(m_primitiveIndices[reference]);
+                }
+                else
+                {
+                    visibility = m_nodeVisibility[node.leftChildIndex()] |
+                                 m_nodeVisibility[node.rightChildIndex()];
+                }
+            }
+        }
+
+        /**
+         * @brief Collapses the binary BVH into the wide BVH of the selected
+         * layout. Only the root of the binary BVH is kept afterwards, as it is
+         * still used for bounding box queries.
+         */
+        void collapseAccelerationStructure()
+        {
+            Timer collapseTimer;
+
+            const bool isWide8 = m_layout == Layout::BVH8 || m_layout == Layout::BVH8Quantized;
+#ifndef LW_BVH_AVX
+            if (isWide8)
+                logger(EWarn, "BVH8 traversal is not vectorized, configure with "
+                              "-DLW_ENABLE_AVX2=ON to make use of it");
+#endif
+            const size_t nodeCount = visitWideBVH([&](auto &bvh)
+                                                  {
+                                                      bvh.build(m_nodes, m_nodeVisibility);
+                                                      return bvh.nodeCount(); });
+
+            m_nodes.resize(1);
+            m_nodes.shrink_to_fit();
+            if (!m_nodeVisibility.empty())
+                m_nodeVisibility.resize(1);
+
+            logger(EInfo, "collapsed BVH into %ld nodes with %d children in %.1f ms",
+                   nodeCount, isWide8 ? 8 : 4,
+                   collapseTimer.getElapsedTime() * 1000);
+        }
+
+        /**
+         * @brief Recomputes the bounding boxes of all nodes for the current
+         * geometry, keeping the topology of the tree. This is much faster than
+         * building a new BVH, but the tree becomes less efficient the further
+         * primitives move away from where they were during the build.
+         */
+        void refitAccelerationStructure()
+        {
+            if (m_primitiveIndices.empty())
+                return;
+
+            Timer refitTimer;
+
+            if (m_layout == Layout::Binary)
+            {
+                // children are always stored after their parent, hence iterating
+                // backwards visits children before their parents
+                for (NodeIndex nodeIndex = NodeIndex(m_nodes.size()) - 1; nodeIndex >= 0; nodeIndex--)
+                {
+                    if (nodeIndex == 1)
+                        continue; // padding
+
+                    Node &node = m_nodes[nodeIndex];
+                    if (node.isLeaf())
+                    {
+                        computeAABB(node, true);
+                    }
+                    else
+                    {
+                        node.aabb = m_nodes[node.leftChildIndex()].aabb;
+                        node.aabb.extend(m_nodes[node.rightChildIndex()].aabb);
+                    }
+                }
+            }
+            else
+            {
+                const auto leafBounds = [&](NodeIndex first, NodeIndex count)
+                {
+                    Node leaf;
+                    leaf.leftFirst = first;
+                    leaf.primitiveCount = count;
+                    computeAABB(leaf, true);
+                    return leaf.aabb;
+                };
+                m_nodes.front().aabb = visitWideBVH([&](auto &bvh)
+                                                    { return bvh.refit(leafBounds); });
+            }
+
+            updateReferences(0, referenceCount());
+
+            logger(EDebug, "refitted BVH in %.1f ms", refitTimer.getElapsedTime() * 1000);
         }
 
     public:
+        bool setFrame(int frame) override
+        {
+            // shapes can be shared, so only the first call per frame does work
+            if (frame != m_frame)
+            {
+                m_frame = frame;
+                m_frameChanged = updateFrame(frame);
+                if (m_frameChanged)
+                {
+                    // lazily subdivided nodes cannot be refit, as they might
+                    // not exist yet
+                    if (m_update == Update::Rebuild || m_lazyThreshold > 0)
+                        buildAccelerationStructure();
+                    else
+                        refitAccelerationStructure();
+                }
+            }
+            return m_frameChanged;
+        }
+
         bool intersect(const Ray &ray, Intersection &its,
                        Sampler &rng) const override
         {
+            return intersectChildren(ray, its, rng);
+        }
+
+        bool occluded(const Ray &ray, Intersection &its,
+                      Sampler &rng) const override
+        {
+            return occludedChildren(ray, its, rng);
+        }
+
+        /**
+         * @brief Traverses the BVH to find the closest hit among the children.
+         * Unlike @ref intersect , this is never wrapped for profiling, and is
+         * overridden by final shapes to test their children without virtual
+         * calls (see @ref intersectPrimitives ).
+         */
+        virtual bool intersectChildren(const Ray &ray, Intersection &its,
+                                       Sampler &rng) const
+        {
+            return intersectPrimitives<false>(ray, its, [&](int reference)
+                                              { return intersect(m_primitiveIndices[reference], ray, its, rng); });
+        }
+
+        /// @brief Traverses the BVH until any child blocks the ray (see @ref intersectChildren ).
+        virtual bool occludedChildren(const Ray &ray, Intersection &its,
+                                      Sampler &rng) const
+        {
+            return intersectPrimitives<true>(ray, its, [&](int reference)
+                                             { return occluded(m_primitiveIndices[reference], ray, its, rng); });
+        }
+
+        RayMask intersectPacket(const Ray *rays, Intersection *its, Sampler *const *rngs,
+                                RayMask active) const override
+        {
+            return intersectLeavesPacket(rays, its, active, [&](NodeIndex first, NodeIndex count, RayMask leafRays)
+                                         {
+                RayMask hits = 0;
+                for (NodeIndex reference = first; reference < first + count; reference++)
+                {
+                    for (RayMask remaining = leafRays; remaining; remaining &= remaining - 1)
+                    {
+                        const int index = std::countr_zero(remaining);
+                        if (intersect(m_primitiveIndices[reference], rays[index], its[index], *rngs[index]))
+                            hits |= RayMask(1) << index;
+                    }
+                }
+                return hits; });
+        }
+
+        /// @brief A short description of the structure for reports (e.g., the
+        /// file a mesh has been loaded from).
+        virtual std::string describe() const { return "acceleration structure"; }
+
+        /**
+         * @brief Analyzes the tree in the layout used for traversal (i.e., the
+         * wide BVH for wide layouts, whose leaves are the children of its nodes).
+         */
+        BvhStatistics statistics() const
+        {
+            BvhStatistics result;
             if (m_primitiveIndices.empty())
-                return false; // exit early if no children exist
-            if (intersectAABB(rootNode().aabb, ray) <
-                its.t) // test root bounding box for potential hit
-                return intersectNode(rootNode(), ray, its, rng);
-            return false;
+                return result;
+
+            double sahCost = 0, depthSum = 0, overlapArea = 0, parentArea = 0;
+            const auto visitNode = [&](const Bounds *children, int childCount)
+            {
+                Bounds aabb = Bounds::empty();
+                for (int i = 0; i < childCount; i++)
+                {
+                    aabb.extend(children[i]);
+                    for (int j = i + 1; j < childCount; j++)
+                        overlapArea += surfaceArea(overlap(children[i], children[j]));
+                }
+                result.internalNodes++;
+                sahCost += m_traversalCost * surfaceArea(aabb);
+                parentArea += surfaceArea(aabb);
+            };
+            const auto visitLeaf = [&](const Bounds &aabb, int primitiveCount, int depth)
+            {
+                result.leaves++;
+                result.references += primitiveCount;
+                sahCost += m_intersectionCost * relativeIntersectionCost() * primitiveCount * surfaceArea(aabb);
+                depthSum += depth;
+                result.maxDepth = std::max(result.maxDepth, depth);
+                if (result.leafSizes.size() <= size_t(primitiveCount))
+                    result.leafSizes.resize(primitiveCount + 1);
+                result.leafSizes[primitiveCount]++;
+            };
+
+            if (m_layout == Layout::Binary)
+            {
+                // lazily subdivided nodes count as leaves until a ray has reached
+                // them
+                struct StackEntry
+                {
+                    const NodeList *nodes;
+                    const LazyNodes *lazy;
+                    NodeIndex nodeIndex;
+                    int depth;
+                };
+                std::vector<StackEntry> stack = {{&m_nodes, &m_lazyNodes, 0, 0}};
+                while (!stack.empty())
+                {
+                    const StackEntry entry = stack.back();
+                    stack.pop_back();
+                    const NodeList &nodes = *entry.nodes;
+                    const Node &node = nodes[entry.nodeIndex];
+                    if (node.isLeaf() && isDeferred(*entry.lazy, entry.nodeIndex))
+                    {
+                        const LazyNode &lazyNode = *entry.lazy->nodes[entry.lazy->indexOfNode[entry.nodeIndex]];
+                        if (lazyNode.isSubdivided.load(std::memory_order_acquire))
+                        {
+                            stack.push_back({&lazyNode.subtree, &lazyNode.lazy, 0, entry.depth});
+                            continue;
+                        }
+                    }
+                    if (node.isLeaf())
+                    {
+                        visitLeaf(node.aabb, node.primitiveCount, entry.depth);
+                        continue;
+                    }
+
+                    const Bounds children[2] = {nodes[node.leftChildIndex()].aabb,
+                                                nodes[node.rightChildIndex()].aabb};
+                    visitNode(children, 2);
+                    stack.push_back({entry.nodes, entry.lazy, node.leftChildIndex(), entry.depth + 1});
+                    stack.push_back({entry.nodes, entry.lazy, node.rightChildIndex(), entry.depth + 1});
+                }
+            }
+            else
+            {
+                visitWideBVH([&](const auto &bvh)
+                             { bvh.visit(visitNode, visitLeaf); });
+            }
+
+            result.sahCost = float(sahCost / surfaceArea(rootNode().aabb));
+            result.averageDepth = float(depthSum / result.leaves);
+            result.siblingOverlap = parentArea > 0 ? float(overlapArea / parentArea) : 0;
+            return result;
         }
 
         Bounds getBoundingBox() const override { return rootNode().aabb; }
 
+        uint8_t visibility() const override
+        {
+            return m_nodeVisibility.empty() ? AllRayTypes : m_nodeVisibility.front();
+        }
+
         Point getCentroid() const override { return rootNode().aabb.center(); }
     };
 
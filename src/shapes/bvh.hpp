@@ -0,0 +1,181 @@
+#pragma once
+
+#include <lightwave/core.hpp>
+#include <lightwave/math.hpp>
+#include <lightwave/iterators.hpp>
+#include <lightwave/parallel.hpp>
+
+#include <array>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+namespace lightwave
+{
+
+    /**
+     * @brief An allocator for standard containers that aligns the storage to
+     * a given number of bytes (e.g., to the size of a cache line).
+     */
+    template <typename T, std::size_t Alignment>
+    struct AlignedAllocator
+    {
+        typedef T value_type;
+
+        template <typename U>
+        struct rebind
+        {
+            typedef AlignedAllocator<U, Alignment> other;
+        };
+
+        AlignedAllocator() = default;
+        template <typename U>
+        AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+        T *allocate(std::size_t count)
+        {
+            return static_cast<T *>(::operator new(
+                count * sizeof(T), std::align_val_t(Alignment)));
+        }
+
+        void deallocate(T *pointer, std::size_t)
+        {
+            ::operator delete(pointer, std::align_val_t(Alignment));
+        }
+
+        template <typename U>
+        bool operator==(const AlignedAllocator<U, Alignment> &) const
+        {
+            return true;
+        }
+    };
+
+    /**
+     * @brief A ray prepared for BVH traversal, which stores the reciprocal
+     * of the direction so that slab tests only need multiplications.
+     */
+    struct TraversalRay
+    {
+        /// @brief The origin of the ray.
+        Point origin;
+        /// @brief The componentwise reciprocal of the ray direction.
+        Vector invDirection;
+        /// @brief Whether the ray direction is negative along each axis, i.e.,
+        /// whether the ray enters the maximum slab of that axis first.
+        std::array<bool, 3> isNegative;
+
+        TraversalRay() = default;
+        explicit TraversalRay(const Ray &ray) : origin(ray.origin)
+        {
+            for (int dim = 0; dim < 3; dim++)
+            {
+                invDirection[dim] = 1 / ray.direction[dim];
+                isNegative[dim] = invDirection[dim] < 0;
+            }
+        }
+    };
+
+    /// @brief Inserts two zero bits after each of the lowest 21 bits of a value.
+    inline uint64_t expandBits(uint64_t value)
+    {
+        value &= 0x1fffff;
+        value = (value | value << 32) & 0x1f00000000ffff;
+        value = (value | value << 16) & 0x1f0000ff0000ff;
+        value = (value | value << 8) & 0x100f00f00f00f00f;
+        value = (value | value << 4) & 0x10c30c30c30c30c3;
+        value = (value | value << 2) & 0x1249249249249249;
+        return value;
+    }
+
+    /// @brief The number of bits per axis of a Morton code.
+    static constexpr int MortonBits = 21;
+
+    /**
+     * @brief Interleaves the bits of three coordinates (each with 21 bits)
+     * into a 63 bit Morton code, so that sorting by the code orders points
+     * along a Z-order curve.
+     */
+    inline uint64_t mortonCode(uint32_t x, uint32_t y, uint32_t z)
+    {
+        return expandBits(x) << 2 | expandBits(y) << 1 | expandBits(z);
+    }
+
+    /**
+     * @brief Sorts keys (and their associated values) in ascending order, using
+     * a stable least significant digit radix sort that processes chunks of the
+     * input in parallel.
+     * @param keyBits The number of lowest bits of the keys that can be non-zero.
+     */
+    template <typename Value>
+    void radixSort(std::vector<uint64_t> &keys, std::vector<Value> &values,
+                   int keyBits = 64)
+    {
+        constexpr int DigitBits = 8;
+        constexpr int Buckets = 1 << DigitBits;
+        constexpr int ChunkSize = 16384;
+
+        const int count = int(keys.size());
+        if (count < 2)
+            return;
+        const int chunkCount = (count + ChunkSize - 1) / ChunkSize;
+        std::vector<uint64_t> sortedKeys(count);
+        std::vector<Value> sortedValues(count);
+        std::vector<std::array<int, Buckets>> offsets(chunkCount);
+        // inputs that fit into a single chunk are not worth starting threads for
+        const auto forEachChunk = [&](auto &&f)
+        {
+            if (chunkCount <= 1)
+                f(Range(0, count));
+            else
+                for_each_parallel(ChunkedRange(0, count, ChunkSize), f);
+        };
+
+        for (int shift = 0; shift < keyBits; shift += DigitBits)
+        {
+            const auto digit = [&](uint64_t key)
+            { return int(key >> shift) & (Buckets - 1); };
+
+            // count the digits of every chunk
+            forEachChunk([&](Range chunk)
+                         {
+                auto &histogram = offsets[*chunk.begin() / ChunkSize];
+                histogram.fill(0);
+                for (int i : chunk)
+                    histogram[digit(keys[i])]++; });
+
+            // turn the counts into output positions, where every chunk writes
+            // after the previous chunks for the same digit (which keeps the sort
+            // stable)
+            int position = 0;
+            bool isSorted = false;
+            for (int bucket = 0; bucket < Buckets; bucket++)
+            {
+                const int bucketStart = position;
+                for (auto &histogram : offsets)
+                {
+                    const int bucketCount = histogram[bucket];
+                    histogram[bucket] = position;
+                    position += bucketCount;
+                }
+                // all keys share this digit, so the pass would not change anything
+                isSorted |= bucketStart == 0 && position == count;
+            }
+            if (isSorted)
+                continue;
+
+            forEachChunk([&](Range chunk)
+                         {
+                auto &positions = offsets[*chunk.begin() / ChunkSize];
+                for (int i : chunk)
+                {
+                    const int target = positions[digit(keys[i])]++;
+                    sortedKeys[target] = keys[i];
+                    sortedValues[target] = values[i];
+                } });
+
+            keys.swap(sortedKeys);
+            values.swap(sortedValues);
+        }
+    }
+
+} // namespace lightwave
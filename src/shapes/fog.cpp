@@ -32,6 +32,7 @@ namespace lightwave
     }
         bool intersect(const Ray &ray, Intersection &its, Sampler &rng) const override
         {
+            its.deferredShape = nullptr;
             populate(its, Point(1000, 1000, 1000));
             return true;
         }
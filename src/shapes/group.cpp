@@ -8,17 +8,198 @@ namespace lightwave {
  * @brief A group is a shape that results from the union of an arbitrary amount of individual shapes.
  * This allows us to avoid manually iterating over all objects in the scene whenever we need to find an intersection,
  * and also provides noticeable speed-up by using an acceleration structure under the hood.
+ * Children that are instances are intersected directly (see @ref FlatInstance ), which matters for scenes that consist
+ * of thousands of instances.
  */
 class Group final : public AccelerationStructure {
     std::vector<ref<Shape>> m_children;
 
+    /**
+     * @brief A child instance, flattened so that rays can be transformed into its object coordinates and handed to
+     * the wrapped shape (typically the BVH of a mesh) without a detour through @ref Instance::intersect .
+     */
+    struct FlatInstance {
+        /// @brief The transform from world to object coordinates (the affine part of the homogeneous matrix).
+        float worldToObject[3][4];
+        /// @brief The factor by which the transform scales all lengths, or 0 if it depends on the direction.
+        float scale;
+        /// @brief The instance, or null if the child is intersected as regular shape.
+        const Instance *instance;
+        /// @brief The wrapped shape.
+        const Shape *shape;
+        /// @brief The wrapped shape if it is an acceleration structure, which is then traversed directly.
+        const AccelerationStructure *bvh;
+        /// @brief The alpha mask of the instance.
+        Texture *alphaMask;
+        /// @brief The kinds of rays that can hit the instance.
+        uint8_t visibility;
+    };
+    /// @brief The flattened children, in the same order as m_children .
+    std::vector<FlatInstance> m_instances;
+
+    /**
+     * @brief Flattens all children that are instances (except for instances with media and projective transforms),
+     * which needs to be repeated whenever their transforms change.
+     */
+    void flattenInstances() {
+        m_instances.assign(m_children.size(), FlatInstance {});
+        for (size_t i = 0; i < m_children.size(); i++) {
+            const auto instance = dynamic_cast<const Instance *>(m_children[i].get());
+            if (!instance || instance->hasMedium()) {
+                continue;
+            }
+
+            const Matrix4x4 matrix = instance->transform()
+                ? instance->transform()->inverseMatrix()
+                : Matrix4x4::identity();
+            if (matrix.row(3) != Vector4(0, 0, 0, 1)) {
+                continue;
+            }
+
+            FlatInstance &flat = m_instances[i];
+            for (int row = 0; row < 3; row++) {
+                for (int column = 0; column < 4; column++) {
+                    flat.worldToObject[row][column] = matrix(row, column);
+                }
+            }
+
+            // rotations and uniform scaling change the length of every direction by the same factor
+            const auto linear = matrix.submatrix<3, 3>(0, 0);
+            const float squaredScale = linear.column(0).lengthSquared();
+            bool isUniform = true;
+            for (int a = 0; a < 3; a++) {
+                for (int b = 0; b < 3; b++) {
+                    const float expected = a == b ? squaredScale : 0;
+                    isUniform &= std::abs(linear.column(a).dot(linear.column(b)) - expected) <= 1e-6f * squaredScale;
+                }
+            }
+            flat.scale = isUniform ? std::sqrt(squaredScale) : 0;
+
+            flat.instance = instance;
+            flat.shape = instance->shape();
+            flat.bvh = dynamic_cast<const AccelerationStructure *>(flat.shape);
+            flat.alphaMask = instance->alphaMask();
+            flat.visibility = instance->visibility();
+        }
+    }
+
+    /**
+     * @brief Transforms a ray into the object coordinates of a flattened instance (with normalized direction).
+     * @return The factor by which distances along the ray grow in object coordinates.
+     */
+    static float toObject(const FlatInstance &flat, const Ray &ray, Ray &localRay) {
+        const auto &m = flat.worldToObject;
+        localRay.depth = ray.depth;
+        for (int row = 0; row < 3; row++) {
+            localRay.origin[row] = m[row][0] * ray.origin.x() + m[row][1] * ray.origin.y() +
+                m[row][2] * ray.origin.z() + m[row][3];
+            localRay.direction[row] = m[row][0] * ray.direction.x() + m[row][1] * ray.direction.y() +
+                m[row][2] * ray.direction.z();
+        }
+
+        const float scale = flat.scale > 0 ? flat.scale : localRay.direction.length();
+        localRay.direction = localRay.direction / scale;
+        return scale;
+    }
+
 protected:
     int numberOfPrimitives() const override {
         return int(m_children.size());
     }
 
     bool intersect(int primitiveIndex, const Ray &ray, Intersection &its, Sampler &rng) const override {
-        return m_children[primitiveIndex]->intersect(ray, its, rng);
+        const FlatInstance &flat = m_instances[primitiveIndex];
+        if (!flat.instance) {
+            return m_children[primitiveIndex]->intersect(ray, its, rng);
+        }
+        if (!(flat.visibility & its.rayType)) {
+            return false;
+        }
+
+        // same as Instance::intersect, but without virtual calls until the BVH of the instance is traversed
+        Ray localRay;
+        const float scale = toObject(flat, ray, localRay);
+        const float previousT = its.t;
+        its.t = previousT * scale;
+        its.alpha_mask = flat.alphaMask;
+
+        const bool wasIntersected = flat.bvh
+            ? flat.bvh->intersectChildren(localRay, its, rng)
+            : flat.shape->intersect(localRay, its, rng);
+        if (!wasIntersected) {
+            its.t = previousT;
+            return false;
+        }
+        its.t = its.t / scale;
+        flat.instance->completeIntersection(its);
+        return true;
+    }
+
+    /// @brief Intersects a child with a packet of rays, like @ref intersect (handing the packet on to the child).
+    RayMask intersectPacket(int primitiveIndex, const Ray *rays, Intersection *its, Sampler *const *rngs,
+                            RayMask active) const {
+        const FlatInstance &flat = m_instances[primitiveIndex];
+        if (!flat.instance) {
+            return m_children[primitiveIndex]->intersectPacket(rays, its, rngs, active);
+        }
+
+        Ray localRays[MaxPacketSize];
+        float scales[MaxPacketSize];
+        float previousTs[MaxPacketSize];
+        for (RayMask remaining = active; remaining; remaining &= remaining - 1) {
+            const int index = std::countr_zero(remaining);
+            if (!(flat.visibility & its[index].rayType)) {
+                active &= ~(RayMask(1) << index);
+                continue;
+            }
+            scales[index] = toObject(flat, rays[index], localRays[index]);
+            previousTs[index] = its[index].t;
+            its[index].t = previousTs[index] * scales[index];
+            its[index].alpha_mask = flat.alphaMask;
+        }
+
+        if (!active) {
+            return 0;
+        }
+
+        const RayMask hits = flat.shape->intersectPacket(localRays, its, rngs, active);
+        for (RayMask remaining = active; remaining; remaining &= remaining - 1) {
+            const int index = std::countr_zero(remaining);
+            if (hits >> index & 1) {
+                its[index].t = its[index].t / scales[index];
+                flat.instance->completeIntersection(its[index]);
+            } else {
+                its[index].t = previousTs[index];
+            }
+        }
+        return hits;
+    }
+
+    bool occluded(int primitiveIndex, const Ray &ray, Intersection &its, Sampler &rng) const override {
+        const FlatInstance &flat = m_instances[primitiveIndex];
+        if (!flat.instance) {
+            return m_children[primitiveIndex]->occluded(ray, its, rng);
+        }
+        if (!(flat.visibility & its.rayType)) {
+            return false;
+        }
+
+        Ray localRay;
+        const float scale = toObject(flat, ray, localRay);
+        const float previousT = its.t;
+        its.t = previousT * scale;
+        its.alpha_mask = flat.alphaMask;
+
+        const bool isOccluded = flat.bvh
+            ? flat.bvh->occludedChildren(localRay, its, rng)
+            : flat.shape->occluded(localRay, its, rng);
+        if (!isOccluded) {
+            its.t = previousT;
+            return false;
+        }
+        its.t = its.t / scale;
+        flat.instance->completeOcclusion(its);
+        return true;
     }
 
     Bounds getBoundingBox(int primitiveIndex) const override {
@@ -29,9 +210,25 @@ protected:
         return m_children[primitiveIndex]->getCentroid();
     }
 
+    uint8_t primitiveVisibility(int primitiveIndex) const override {
+        return m_children[primitiveIndex]->visibility();
+    }
+
+    bool updateFrame(int frame) override {
+        // every child needs to be updated, hence no short-circuiting
+        bool changed = false;
+        for (auto &child : m_children) changed |= child->setFrame(frame);
+        if (changed) {
+            flattenInstances();
+        }
+        return changed;
+    }
+
 public:
-    Group(const Properties &properties) {
+    Group(const Properties &properties)
+    : AccelerationStructure(properties) {
         m_children = properties.getChildren<Shape>();
+        flattenInstances();
         buildAccelerationStructure();
     }
 
@@ -39,6 +236,41 @@ public:
         for (auto &child : m_children) child->markAsVisible();
     }
 
+    bool intersectChildren(const Ray &ray, Intersection &its, Sampler &rng) const override {
+        return intersectPrimitives<false>(ray, its, [&](int reference) {
+            return Group::intersect(referencedPrimitive(reference), ray, its, rng);
+        });
+    }
+
+    bool occludedChildren(const Ray &ray, Intersection &its, Sampler &rng) const override {
+        return intersectPrimitives<true>(ray, its, [&](int reference) {
+            return Group::occluded(referencedPrimitive(reference), ray, its, rng);
+        });
+    }
+
+    RayMask intersectPacket(const Ray *rays, Intersection *its, Sampler *const *rngs,
+                            RayMask active) const override {
+        return intersectLeavesPacket(rays, its, active, [&](int first, int count, RayMask leafRays) {
+            RayMask hits = 0;
+            for (int reference = first; reference < first + count; reference++) {
+                hits |= Group::intersectPacket(referencedPrimitive(reference), rays, its, rngs, leafRays);
+            }
+            return hits;
+        });
+    }
+
+    void attachAlphaMask(const Texture *alphaMask) override {
+        for (auto &child : m_children) child->attachAlphaMask(alphaMask);
+    }
+
+    void forEachChild(const std::function<void (const Shape &)> &function) const override {
+        for (auto &child : m_children) function(*child);
+    }
+
+    std::string describe() const override {
+        return tfm::format("group of %d shapes", m_children.size());
+    }
+
     AreaSample sampleArea(Sampler &rng) const override {
         int childIndex = int(rng.next() * m_children.size());
         childIndex = std::min(childIndex, int(m_children.size()) - 1);
@@ -2,6 +2,7 @@
 
 #include "../core/plyparser.hpp"
 #include "accel.hpp"
+#include "simd.hpp"
 
 namespace lightwave {
 
@@ -9,15 +10,24 @@ namespace lightwave {
  * @brief A shape consisting of many (potentially millions) of triangles, which share an index and vertex buffer.
  * Since individual triangles are rarely needed (and would pose an excessive amount of overhead), collections of
  * triangles are combined in a single shape.
+ * Meshes can also contain quads (e.g., when exported from Blender), which are a single primitive of the BVH each, but
+ * are shaded as two triangles (see @ref triangleVertices ).
  */
-class TriangleMesh : public AccelerationStructure {
+class TriangleMesh final : public AccelerationStructure {
     /**
      * @brief The index buffer of the triangles.
      * The n-th element corresponds to the n-th triangle, and each component of the element corresponds to one
      * vertex index (into @c m_vertices ) of the triangle.
-     * This list will always contain as many elements as there are triangles.
+     * This list contains every triangle of the mesh, except for the halves of the quads.
      */
     std::vector<Vector3i> m_triangles;
+    /**
+     * @brief The index buffer of the quads, which are expected to be (nearly) planar.
+     * Each quad is split into two triangles along the diagonal from its first to its third vertex, which are numbered
+     * after the triangles of @c m_triangles (see @ref triangleVertices ). The BVH, however, is built over faces (the
+     * triangles followed by the quads), which halves the number of references for meshes of quads.
+     */
+    std::vector<Vector4i> m_quads;
     /**
      * @brief The vertex buffer of the triangles, indexed by m_triangles.
      * Note that multiple triangles can share vertices, hence there can also be fewer than @code 3 * numTriangles @endcode
@@ -28,13 +38,324 @@ class TriangleMesh : public AccelerationStructure {
     std::filesystem::path m_originalPath;
     /// @brief Whether to interpolate the normals from m_vertices, or report the geometric normal instead.
     bool m_smoothNormals;
+    /// @brief Whether quads are split into two triangles while loading, instead of being stored in @c m_quads .
+    bool m_splitQuads;
+    /**
+     * @brief For deforming meshes: The path of the file to load for each frame of an animation, with a printf-style
+     * placeholder for the frame number (e.g., @c "cloth_%04d.ply" ). Empty for static meshes.
+     */
+    std::string m_sequence;
+
+    /**
+     * @brief The positions of the triangles in the order of the BVH leaves (i.e., indexed by reference, see
+     * @ref referencedPrimitive ), stored as the first vertex and the two edges leaving it, with a separate array per
+     * component. Traversal only needs positions, which it can load from here without going through the index buffer
+     * and loading full vertices.
+     */
+    struct LeafTriangles {
+        std::vector<float> v0[3];
+        std::vector<float> edge1[3];
+        std::vector<float> edge2[3];
+        /// @brief For quads: The edge from the first to the fourth vertex, which spans the second triangle together
+        /// with @c edge2 . Triangles store a zero edge instead. Empty if the mesh has no quads.
+        std::vector<float> edge3[3];
+    } m_leafTriangles;
+
+    /**
+     * @brief A cluster (or meshlet) of spatially coherent triangles, which has its own small list of vertex positions
+     * that its triangles refer to by 8-bit indices. With clusters, the BVH is built over clusters instead of triangles,
+     * and traversal loads positions through the clusters instead of from @c m_leafTriangles , which takes about a third
+     * of the memory.
+     */
+    struct Cluster {
+        /// @brief The first triangle of the cluster in @c m_clusterIndices and @c m_clusterTriangles .
+        int firstTriangle;
+        /// @brief The number of triangles of the cluster.
+        int triangleCount;
+        /// @brief The first vertex of the cluster in @c m_clusterPositions .
+        int firstVertex;
+        /// @brief The number of vertices of the cluster.
+        int vertexCount;
+    };
+    /// @brief The largest number of vertices in a cluster, which can be addressed by 8-bit indices.
+    static constexpr int MaxClusterVertices = 256;
+    /// @brief The largest supported number of triangles in a cluster (larger clusters rarely fit their vertices in
+    /// 8-bit indices).
+    static constexpr int MaxClusterSize = 128;
+    /// @brief The largest number of triangles per cluster, or 0 if the BVH is built over individual triangles.
+    int m_clusterSize;
+    std::vector<Cluster> m_clusters;
+    /// @brief For each triangle of the clusters: The indices of its vertices in the vertex list of its cluster.
+    std::vector<std::array<uint8_t, 3>> m_clusterIndices;
+    /// @brief For each triangle of the clusters: Its index in @c m_triangles , which is needed to shade hits.
+    std::vector<int> m_clusterTriangles;
+    /// @brief The vertex lists of all clusters (vertices shared by several clusters are stored once per cluster).
+    std::vector<Point> m_clusterPositions;
+
+    /// @brief How an alpha mask affects a triangle, see @ref classifyOpacity .
+    enum class Opacity : uint8_t {
+        /// @brief The alpha mask needs to be evaluated for every hit.
+        Mixed,
+        /// @brief Every hit is kept.
+        Opaque,
+        /// @brief Every hit is dismissed, hence the triangle is left out of the BVH.
+        Transparent,
+    };
+    /// @brief Whether an instance has attached its alpha mask yet (see @ref attachAlphaMask ).
+    bool m_hasInstances = false;
+    /// @brief Whether the BVH has been built, which is deferred until the mesh is attached to the scene (see
+    /// @ref attachAlphaMask and @ref markAsVisible ), so that alpha masks are classified before the only build.
+    bool m_hasBVH = false;
+    /// @brief The bounds of all vertices, which stand in for the bounds of the BVH until it has been built.
+    Bounds m_vertexBounds;
+    /// @brief The alpha mask that all instances of this mesh share (null if they have none, or do not agree).
+    const Texture *m_sharedAlphaMask = nullptr;
+    /// @brief How @c m_sharedAlphaMask affects each triangle (empty if the triangles have not been classified).
+    std::vector<Opacity> m_opacity;
+
+    /// @brief Returns the number of triangles, counting every quad as two triangles.
+    int triangleCount() const {
+        return int(m_triangles.size() + 2 * m_quads.size());
+    }
+
+    /// @brief Returns the number of faces (triangles and quads), which are the primitives of the BVH without clusters.
+    int faceCount() const {
+        return int(m_triangles.size() + m_quads.size());
+    }
+
+    /// @brief Returns the index of the first triangle of a face, which is followed by the second triangle for quads.
+    int firstTriangle(int faceIndex) const {
+        const int triangles = int(m_triangles.size());
+        return faceIndex < triangles ? faceIndex : triangles + 2 * (faceIndex - triangles);
+    }
+
+    /// @brief Returns the number of triangles of a face (two for quads).
+    int faceTriangleCount(int faceIndex) const {
+        return faceIndex < int(m_triangles.size()) ? 1 : 2;
+    }
+
+    /**
+     * @brief Returns the vertex indices of a triangle. The triangles after those of @c m_triangles are the halves of
+     * the quads, which are split along the diagonal from their first to their third vertex.
+     */
+    Vector3i triangleVertices(int triangleIndex) const {
+        const int triangles = int(m_triangles.size());
+        if (triangleIndex < triangles) {
+            return m_triangles[triangleIndex];
+        }
+        const Vector4i &quad = m_quads[(triangleIndex - triangles) / 2];
+        return (triangleIndex - triangles) % 2 == 0
+            ? Vector3i { quad[0], quad[1], quad[2] }
+            : Vector3i { quad[0], quad[2], quad[3] };
+    }
+
+    /**
+     * @brief Classifies every triangle by the range of values that the alpha mask takes over its texture footprint
+     * (in the spirit of opacity micromaps, but for entire triangles).
+     * @return The number of triangles that are fully transparent.
+     */
+    int classifyOpacity(const Texture &alphaMask) {
+        Timer classifyTimer;
+        m_opacity.assign(triangleCount(), Opacity::Mixed);
+
+        int counts[3] = {};
+        for (int primitiveIndex = 0; primitiveIndex < triangleCount(); primitiveIndex++) {
+            const Vector3i vertices_indices = triangleVertices(primitiveIndex);
+            float min, max;
+            if (alphaMask.redRange(
+                    m_vertices[vertices_indices.x()].texcoords,
+                    m_vertices[vertices_indices.y()].texcoords,
+                    m_vertices[vertices_indices.z()].texcoords,
+                    min, max)) {
+                // hits are dismissed if the alpha value is below a uniform random number in [0,1)
+                if (max <= 0) {
+                    m_opacity[primitiveIndex] = Opacity::Transparent;
+                } else if (min >= 1) {
+                    m_opacity[primitiveIndex] = Opacity::Opaque;
+                }
+            }
+            counts[int(m_opacity[primitiveIndex])]++;
+        }
+
+        if (counts[int(Opacity::Transparent)] == triangleCount()) {
+            // keep the BVH from becoming empty, which would leave the mesh without bounds
+            std::fill(m_opacity.begin(), m_opacity.end(), Opacity::Mixed);
+            counts[int(Opacity::Mixed)] = counts[int(Opacity::Transparent)];
+            counts[int(Opacity::Transparent)] = 0;
+        }
+
+        logger(EInfo, "alpha mask classified %d triangles as opaque, %d as transparent and %d as mixed in %.1f ms",
+            counts[int(Opacity::Opaque)], counts[int(Opacity::Transparent)], counts[int(Opacity::Mixed)],
+            classifyTimer.getElapsedTime() * 1000);
+        return counts[int(Opacity::Transparent)];
+    }
+
+    /// @brief Whether a triangle is kept in the BVH, i.e., is not fully transparent (see @ref classifyOpacity ).
+    bool isTriangleKept(int primitiveIndex) const {
+        return m_opacity.empty() || m_opacity[primitiveIndex] != Opacity::Transparent;
+    }
+
+    /// @brief Whether a face is kept in the BVH, i.e., whether any of its triangles is kept.
+    bool isFaceKept(int faceIndex) const {
+        const int first = firstTriangle(faceIndex);
+        for (int triangle = first; triangle < first + faceTriangleCount(faceIndex); triangle++) {
+            if (isTriangleKept(triangle)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief Groups the triangles into clusters of at most @c m_clusterSize triangles (and @c MaxClusterVertices
+     * vertices), by recursively splitting them at the median of their centroids along the longest axis.
+     */
+    void buildClusters() {
+        Timer clusterTimer;
+        m_clusters.clear();
+        m_clusterIndices.clear();
+        m_clusterTriangles.clear();
+        m_clusterPositions.clear();
+
+        std::vector<int> triangles;
+        std::vector<Point> centroids(triangleCount());
+        for (int primitiveIndex = 0; primitiveIndex < triangleCount(); primitiveIndex++) {
+            if (isTriangleKept(primitiveIndex)) {
+                triangles.push_back(primitiveIndex);
+                centroids[primitiveIndex] = getTriangleCentroid(primitiveIndex);
+            }
+        }
+
+        std::vector<int> localIndices(m_vertices.size(), -1);
+        splitClusters(triangles.data(), triangles.data() + triangles.size(), centroids, localIndices);
+        m_clusters.shrink_to_fit();
+        m_clusterIndices.shrink_to_fit();
+        m_clusterTriangles.shrink_to_fit();
+        m_clusterPositions.shrink_to_fit();
+
+        const size_t clusterMemory = m_clusters.size() * sizeof(Cluster) +
+            m_clusterIndices.size() * (sizeof(m_clusterIndices[0]) + sizeof(int)) +
+            m_clusterPositions.size() * sizeof(Point);
+        logger(EInfo, "grouped %d triangles into %d clusters with %.1f vertices each in %.1f ms "
+            "(%.2f MiB, instead of %.2f MiB for the leaf triangles)",
+            m_clusterIndices.size(), m_clusters.size(), double(m_clusterPositions.size()) / m_clusters.size(),
+            clusterTimer.getElapsedTime() * 1000, clusterMemory / 1048576.0,
+            m_clusterIndices.size() * 9 * sizeof(float) / 1048576.0);
+    }
+
+    /// @brief Splits the given triangles until they fit into clusters (see @ref buildClusters ).
+    void splitClusters(int *begin, int *end, const std::vector<Point> &centroids, std::vector<int> &localIndices) {
+        if (end - begin <= m_clusterSize && addCluster(begin, end, localIndices)) {
+            return;
+        }
+
+        Bounds bounds = Bounds::empty();
+        for (const int *triangle = begin; triangle != end; triangle++) {
+            bounds.extend(centroids[*triangle]);
+        }
+        const int axis = bounds.diagonal().maxComponentIndex();
+        int *middle = begin + (end - begin) / 2;
+        std::nth_element(begin, middle, end, [&](int a, int b) {
+            return centroids[a][axis] < centroids[b][axis];
+        });
+        splitClusters(begin, middle, centroids, localIndices);
+        splitClusters(middle, end, centroids, localIndices);
+    }
+
+    /**
+     * @brief Adds a cluster of the given triangles, unless they have too many vertices for 8-bit indices.
+     * @param localIndices The index of every vertex in the vertex list of the cluster, which is -1 for all vertices
+     * before and after the call.
+     */
+    bool addCluster(const int *begin, const int *end, std::vector<int> &localIndices) {
+        Cluster cluster;
+        cluster.firstTriangle = int(m_clusterIndices.size());
+        cluster.triangleCount = int(end - begin);
+        cluster.firstVertex = int(m_clusterPositions.size());
+
+        bool fits = true;
+        for (const int *triangle = begin; triangle != end && fits; triangle++) {
+            const Vector3i vertices_indices = triangleVertices(*triangle);
+            std::array<uint8_t, 3> indices;
+            for (int i = 0; i < 3; i++) {
+                const int vertex = vertices_indices[i];
+                if (localIndices[vertex] < 0) {
+                    if (int(m_clusterPositions.size()) - cluster.firstVertex == MaxClusterVertices) {
+                        fits = false;
+                        break;
+                    }
+                    localIndices[vertex] = int(m_clusterPositions.size()) - cluster.firstVertex;
+                    m_clusterPositions.push_back(m_vertices[vertex].position);
+                }
+                indices[i] = uint8_t(localIndices[vertex]);
+            }
+            m_clusterIndices.push_back(indices);
+            m_clusterTriangles.push_back(*triangle);
+        }
+
+        for (const int *triangle = begin; triangle != end; triangle++) {
+            const Vector3i vertices_indices = triangleVertices(*triangle);
+            for (int i = 0; i < 3; i++) {
+                localIndices[vertices_indices[i]] = -1;
+            }
+        }
+        if (!fits) {
+            m_clusterIndices.resize(cluster.firstTriangle);
+            m_clusterTriangles.resize(cluster.firstTriangle);
+            m_clusterPositions.resize(cluster.firstVertex);
+            return false;
+        }
+        cluster.vertexCount = int(m_clusterPositions.size()) - cluster.firstVertex;
+        m_clusters.push_back(cluster);
+        return true;
+    }
+
+    /// @brief Copies the current vertex positions into the vertex lists of the clusters (e.g., for deforming meshes).
+    void updateClusterPositions() {
+        for (const Cluster &cluster : m_clusters) {
+            for (int triangle = cluster.firstTriangle; triangle < cluster.firstTriangle + cluster.triangleCount;
+                 triangle++) {
+                const Vector3i vertices_indices = triangleVertices(m_clusterTriangles[triangle]);
+                for (int i = 0; i < 3; i++) {
+                    m_clusterPositions[cluster.firstVertex + m_clusterIndices[triangle][i]] =
+                        m_vertices[vertices_indices[i]].position;
+                }
+            }
+        }
+    }
+
+    /// @brief Groups the triangles into clusters (if enabled), and builds the BVH over them.
+    void buildBVH() {
+        if (m_clusterSize > 0) {
+            buildClusters();
+        }
+        buildAccelerationStructure();
+        m_hasBVH = true;
+    }
 
 protected:
     int numberOfPrimitives() const override {
-        return int(m_triangles.size());
+        return m_clusterSize > 0 ? int(m_clusters.size()) : faceCount();
     }
 
-    bool intersect(int primitiveIndex, const Ray &ray, Intersection &its, Sampler &rng) const override {
+    float relativeIntersectionCost() const override {
+        // a cluster costs about as much as all of its triangles, and a quad as much as two triangles
+        return m_clusterSize > 0
+            ? float(m_clusterIndices.size()) / m_clusters.size()
+            : float(triangleCount()) / faceCount();
+    }
+
+    /**
+     * @brief Intersects a single triangle with a ray (Möller-Trumbore), without populating any attributes.
+     * @param p0 The first vertex of the triangle.
+     * @param v0v1 The edge from the first to the second vertex.
+     * @param v0v2 The edge from the first to the third vertex.
+     * @param t Receives the distance of the hit.
+     * @param barycentrics Receives the barycentric coordinates (u, v) of the hit within the triangle.
+     * @return Whether the triangle is hit before @c tMax .
+     */
+    static bool intersectTriangle(const Point &p0, const Vector &v0v1, const Vector &v0v2,
+                                  const Ray &ray, float tMax, float &t, Vector2 &barycentrics) {
         // weights:
         // man kann ja mit zwei Vektoren einen dritten darstellen 
         // (vector a, vector b, vector zu Punkt c ist a + b)
@@ -48,14 +369,6 @@ protected:
         Vector ray_origin_vector = ray.origin - Point(0.0f);
         Vector ray_direction = ray.direction;
 
-        Vector3i vertices_indices = m_triangles[primitiveIndex];
-        Vertex v0 = m_vertices[vertices_indices.x()];
-        Vertex v1 = m_vertices[vertices_indices.y()];
-        Vertex v2 = m_vertices[vertices_indices.z()];
-
-        Vector v0v1 = v1.position - v0.position;
-        Vector v0v2 = v2.position - v0.position;
-
         Vector pvec = ray_direction.cross(v0v2);
         float determinant = v0v1.dot(pvec);
 
@@ -68,7 +381,7 @@ protected:
 
         float invDet = 1 / determinant;
 
-        Vector tvec = ray_origin_vector - v0.position;
+        Vector tvec = ray_origin_vector - p0;
         float u = tvec.dot(pvec) * invDet;
         if (u > 1 || u < 0) {
             return false;
@@ -80,51 +393,639 @@ protected:
             return false;
         }
 
-
         float t_candidate = v0v2.dot(qvec) * invDet;
+        if (t_candidate > Epsilon2 && tMax > t_candidate) {
+            t = t_candidate;
+            barycentrics = Vector2(u, v);
+            return true;
+        }
+        return false;
+    }
+
+    /// @brief Returns whether hits of a triangle can never be dismissed by the alpha mask of the intersection (if any).
+    bool isOpaque(int primitiveIndex, const Intersection &its) const {
+        if (its.alpha_mask == nullptr) {
+            return true;
+        }
+        return its.alpha_mask == m_sharedAlphaMask && !m_opacity.empty() &&
+            m_opacity[primitiveIndex] == Opacity::Opaque;
+    }
+
+    /**
+     * @brief Stochastically decides whether a hit is dismissed by the alpha mask of the intersection (if any).
+     * Triangles that are known to be opaque for the alpha mask skip the texture lookup.
+     */
+    bool isTransparent(int primitiveIndex, const Vector2 &barycentrics, const Intersection &its, Sampler &rng) const {
+        if (isOpaque(primitiveIndex, its)) {
+            return false;
+        }
+        return its.alpha_mask->evaluate(interpolateTexcoords(primitiveIndex, barycentrics)).r() < rng.next();
+    }
+
+    /// @brief Intersects a triangle given by its index (see @ref triangleVertices ).
+    bool intersectTriangle(int primitiveIndex, const Ray &ray, float tMax, float &t, Vector2 &barycentrics) const {
+        const Vector3i vertices_indices = triangleVertices(primitiveIndex);
+        const Point &p0 = m_vertices[vertices_indices.x()].position;
+        const Point &p1 = m_vertices[vertices_indices.y()].position;
+        const Point &p2 = m_vertices[vertices_indices.z()].position;
+        return intersectTriangle(p0, p1 - p0, p2 - p0, ray, tMax, t, barycentrics);
+    }
 
+    /**
+     * @brief Decides which triangles of a face (see @ref faceTriangleCount ) a ray can hit, so that quads mostly take a
+     * single triangle test instead of two.
+     * The ray passes one side of the diagonal of a quad (from its first to its third vertex), given by the sign of the
+     * first barycentric coordinate within the first triangle. Unless the quad folds over as seen from the ray (i.e.,
+     * its triangles face opposite ways), only the triangle on that side can be hit.
+     * @return The bitmask of the triangles to test (bit 0 for the first one, bit 1 for the second one of quads).
+     */
+    int leafFaceHalves(int reference, const Ray &ray) const {
+        const LeafTriangles &leaf = m_leafTriangles;
+        if (leaf.edge3[0].empty()) {
+            return 1;
+        }
+        const Point p0 { leaf.v0[0][reference], leaf.v0[1][reference], leaf.v0[2][reference] };
+        const Vector v0v1 { leaf.edge1[0][reference], leaf.edge1[1][reference], leaf.edge1[2][reference] };
+        const Vector v0v2 { leaf.edge2[0][reference], leaf.edge2[1][reference], leaf.edge2[2][reference] };
+        const Vector v0v3 { leaf.edge3[0][reference], leaf.edge3[1][reference], leaf.edge3[2][reference] };
 
-        if (t_candidate > Epsilon2 && its.t > t_candidate) {
-            Vector2 uv_vector = Vector2(u,v);
-            Point2 uv = Vertex::interpolate(uv_vector, v0 , v1, v2).texcoords;
-            if (its.alpha_mask != nullptr) {
-                // valid alpha_mask value
-                // check if the intersection still occurs
-                if (its.alpha_mask->evaluate(uv).r() < rng.next()) {
-                    return false;
+        const float Epsilon = 1e-8f;
+        const Vector pvec = ray.direction.cross(v0v2);
+        const float determinant = v0v1.dot(pvec);
+        const float secondDeterminant = v0v2.dot(ray.direction.cross(v0v3));
+        if (secondDeterminant > -Epsilon && secondDeterminant < Epsilon) {
+            // a triangle (which stores a zero edge3), or a quad whose second triangle cannot be hit
+            return 1;
+        }
+        if (determinant > -Epsilon && determinant < Epsilon) {
+            return 2;
+        }
+        if ((determinant < 0) != (secondDeterminant < 0)) {
+            return 3;
+        }
+        // the sign of the first barycentric coordinate, without dividing by the determinant
+        const float scaledU = (ray.origin - p0).dot(pvec);
+        return (scaledU < 0 && determinant > 0) || (scaledU > 0 && determinant < 0) ? 2 : 1;
+    }
+
+    /**
+     * @brief Intersects a triangle of a face given by its position in the BVH leaves, loading it from
+     * @c m_leafTriangles .
+     * @param half Which triangle of the face to test (the second one only exists for quads).
+     */
+    bool intersectLeafTriangle(int reference, int half, const Ray &ray, float tMax, float &t,
+                               Vector2 &barycentrics) const {
+        const LeafTriangles &leaf = m_leafTriangles;
+        const Point p0 { leaf.v0[0][reference], leaf.v0[1][reference], leaf.v0[2][reference] };
+        const Vector v0v1 { leaf.edge1[0][reference], leaf.edge1[1][reference], leaf.edge1[2][reference] };
+        const Vector v0v2 { leaf.edge2[0][reference], leaf.edge2[1][reference], leaf.edge2[2][reference] };
+        if (half == 0) {
+            return intersectTriangle(p0, v0v1, v0v2, ray, tMax, t, barycentrics);
+        }
+        const Vector v0v3 { leaf.edge3[0][reference], leaf.edge3[1][reference], leaf.edge3[2][reference] };
+        return intersectTriangle(p0, v0v2, v0v3, ray, tMax, t, barycentrics);
+    }
+
+#if defined(LW_BVH_SSE)
+    /**
+     * @brief Intersects a packet of @c SimdFloat::Width triangles with a ray at once, computing exactly the same values
+     * for every lane as @ref intersectTriangle (including how NaNs are treated).
+     * @return The bitmask of the lanes that are hit before @c tMax .
+     */
+    static int intersectTrianglePacket(const SimdFloat (&v0)[3], const SimdFloat (&edge1)[3],
+                                       const SimdFloat (&edge2)[3], const SimdFloat (&origin)[3],
+                                       const SimdFloat (&direction)[3], float tMax,
+                                       SimdFloat &t, SimdFloat &u, SimdFloat &v) {
+        typedef SimdFloat F;
+        const F epsilon(1e-8f), selfIntersectionEpsilon(1e-4f), zero(0.f), one(1.f);
+        const F &dx = direction[0], &dy = direction[1], &dz = direction[2];
+        const F &e1x = edge1[0], &e1y = edge1[1], &e1z = edge1[2];
+        const F &e2x = edge2[0], &e2y = edge2[1], &e2z = edge2[2];
+
+        // pvec = direction x edge2
+        const F px = dy * e2z - dz * e2y;
+        const F py = dz * e2x - dx * e2z;
+        const F pz = dx * e2y - dy * e2x;
+        const F determinant = e1x * px + e1y * py + e1z * pz;
+        const F invDet = one / determinant;
+
+        const F tx = origin[0] - v0[0];
+        const F ty = origin[1] - v0[1];
+        const F tz = origin[2] - v0[2];
+        u = (tx * px + ty * py + tz * pz) * invDet;
+
+        // qvec = tvec x edge1
+        const F qx = ty * e1z - tz * e1y;
+        const F qy = tz * e1x - tx * e1z;
+        const F qz = tx * e1y - ty * e1x;
+        v = (dx * qx + dy * qy + dz * qz) * invDet;
+        t = (e2x * qx + e2y * qy + e2z * qz) * invDet;
+
+        const int rejected = (((determinant > zero - epsilon) & (determinant < epsilon)) |
+            (u > one) | (u < zero) | (v < zero) | (u + v > one)).mask();
+        return ((t > selfIntersectionEpsilon) & (F(tMax) > t)).mask() & ~rejected;
+    }
+
+    /**
+     * @brief Intersects a packet of @c SimdFloat::Width faces (triangles or quads) with a ray at once, testing only the
+     * triangle of each face that the ray can hit (see @ref leafFaceHalves ). The values of each lane are exactly those
+     * of @ref intersectTrianglePacket for that triangle, but the quantities that both triangles of a quad share are
+     * only computed once.
+     * @param second Receives the mask of the lanes whose second triangle has been tested.
+     * @param folded Receives the mask of the lanes whose quad folds over as seen from the ray, for which the other
+     * triangle has to be tested as well.
+     * @return The bitmask of the lanes that are hit before @c tMax .
+     */
+    static int intersectFacePacket(const SimdFloat (&v0)[3], const SimdFloat (&edge1)[3],
+                                   const SimdFloat (&edge2)[3], const SimdFloat (&edge3)[3],
+                                   const SimdFloat (&origin)[3], const SimdFloat (&direction)[3], float tMax,
+                                   SimdFloat &t, SimdFloat &u, SimdFloat &v, int &second, int &folded) {
+        typedef SimdFloat F;
+        const F epsilon(1e-8f), selfIntersectionEpsilon(1e-4f), zero(0.f), one(1.f);
+        const F &dx = direction[0], &dy = direction[1], &dz = direction[2];
+
+        // pvec = direction x edge2 for the first triangle, and direction x edge3 for the second one
+        const F px0 = dy * edge2[2] - dz * edge2[1];
+        const F py0 = dz * edge2[0] - dx * edge2[2];
+        const F pz0 = dx * edge2[1] - dy * edge2[0];
+        const F px1 = dy * edge3[2] - dz * edge3[1];
+        const F py1 = dz * edge3[0] - dx * edge3[2];
+        const F pz1 = dx * edge3[1] - dy * edge3[0];
+        const F determinant0 = edge1[0] * px0 + edge1[1] * py0 + edge1[2] * pz0;
+        const F determinant1 = edge2[0] * px1 + edge2[1] * py1 + edge2[2] * pz1;
+
+        const F tx = origin[0] - v0[0];
+        const F ty = origin[1] - v0[1];
+        const F tz = origin[2] - v0[2];
+        // the first barycentric coordinate within either triangle, before dividing by the determinant
+        const F scaledU0 = tx * px0 + ty * py0 + tz * pz0;
+        const F scaledU1 = tx * px1 + ty * py1 + tz * pz1;
+
+        const F degenerate0 = (determinant0 > zero - epsilon) & (determinant0 < epsilon);
+        const F degenerate1 = (determinant1 > zero - epsilon) & (determinant1 < epsilon);
+        // the first barycentric coordinate within the first triangle is negative on the side of the fourth vertex
+        const F fourthSide = ((scaledU0 < zero) & (determinant0 > zero)) | ((scaledU0 > zero) & (determinant0 < zero));
+        // triangles store a zero edge3, hence their second triangle is degenerate and never used
+        const F useSecond = F::select(degenerate1, zero, degenerate0 | fourthSide);
+        second = useSecond.mask();
+        folded = ~(degenerate0 | degenerate1).mask() & ((determinant0 < zero).mask() ^ (determinant1 < zero).mask());
+
+        // the second triangle is spanned by the diagonal and the edge to the fourth vertex
+        const F e1x = F::select(useSecond, edge2[0], edge1[0]);
+        const F e1y = F::select(useSecond, edge2[1], edge1[1]);
+        const F e1z = F::select(useSecond, edge2[2], edge1[2]);
+        const F e2x = F::select(useSecond, edge3[0], edge2[0]);
+        const F e2y = F::select(useSecond, edge3[1], edge2[1]);
+        const F e2z = F::select(useSecond, edge3[2], edge2[2]);
+        const F determinant = F::select(useSecond, determinant1, determinant0);
+        const F invDet = one / determinant;
+        u = F::select(useSecond, scaledU1, scaledU0) * invDet;
+
+        // qvec = tvec x edge1
+        const F qx = ty * e1z - tz * e1y;
+        const F qy = tz * e1x - tx * e1z;
+        const F qz = tx * e1y - ty * e1x;
+        v = (dx * qx + dy * qy + dz * qz) * invDet;
+        t = (e2x * qx + e2y * qy + e2z * qz) * invDet;
+
+        const int rejected = (((determinant > zero - epsilon) & (determinant < epsilon)) |
+            (u > one) | (u < zero) | (v < zero) | (u + v > one)).mask();
+        return ((t > selfIntersectionEpsilon) & (F(tMax) > t)).mask() & ~rejected;
+    }
+
+    /**
+     * @brief Hands the hits of a packet (see @ref intersectTrianglePacket ) to @c accept from the closest to the
+     * farthest, until one is accepted.
+     * @param accept Called as @code accept(lane, t, barycentrics) @endcode , and returns whether the hit has been
+     * accepted.
+     * @return Whether a hit has been accepted.
+     */
+    template <bool AnyHit, typename Accept>
+    static bool acceptPacketHits(int hits, const SimdFloat &t, const SimdFloat &u, const SimdFloat &v,
+                                 Accept &&accept) {
+        typedef SimdFloat F;
+        float tLanes[F::Width], uLanes[F::Width], vLanes[F::Width];
+        t.store(tLanes);
+        u.store(uLanes);
+        v.store(vLanes);
+        while (hits) {
+            // visit the closest hit first (the first one in case of ties, like the scalar version)
+            int lane = std::countr_zero(unsigned(hits));
+            if constexpr (!AnyHit) {
+                for (int other = lane + 1; other < F::Width; other++) {
+                    if ((hits >> other & 1) && tLanes[other] < tLanes[lane]) {
+                        lane = other;
+                    }
                 }
             }
-            its.t = t_candidate;
+            hits &= ~(1 << lane);
 
-            Point hit_point = ray(its.t);
-            its.position = hit_point;
+            if (accept(lane, tLanes[lane], Vector2(uLanes[lane], vLanes[lane]))) {
+                // the remaining hits of this packet are farther away
+                return true;
+            }
+        }
+        return false;
+    }
+#endif
+
+    /**
+     * @brief Intersects all faces of a leaf with a ray, and hands the hits to @c accept from the closest to the
+     * farthest, until one is accepted.
+     * With SSE/AVX, @c SimdFloat::Width faces are tested at once, so only the lanes that are hit need to look up
+     * the index buffer (e.g., for alpha masks). Quads take a single test as well, against the one of their triangles
+     * that the ray can hit (see @ref leafFaceHalves ), and only quads that fold over take a second one.
+     * @tparam AnyHit Whether to return after the first accepted hit, which then need not be the closest one.
+     * @param accept Called as @code accept(primitiveIndex, t, barycentrics) @endcode with the index of the triangle
+     * (see @ref triangleVertices ) for hits closer than @c its.t , and returns whether the hit has been accepted
+     * (updating @c its.t ).
+     */
+    template <bool AnyHit, typename Accept>
+    bool intersectLeafTriangles(int first, int count, const Ray &ray, Intersection &its, Accept &&accept) const {
+        bool wasIntersected = false;
+#if defined(LW_BVH_SSE)
+        typedef SimdFloat F;
+        const LeafTriangles &leaf = m_leafTriangles;
+        const F direction[3] = { F(ray.direction.x()), F(ray.direction.y()), F(ray.direction.z()) };
+        const F origin[3] = { F(ray.origin.x()), F(ray.origin.y()), F(ray.origin.z()) };
+
+        for (int packet = first; packet < first + count; packet += F::Width) {
+            const int laneCount = std::min(F::Width, first + count - packet);
+            const int lanes = (1 << laneCount) - 1;
+            // the last packet must not read past the leaf, as lazily built nodes might rewrite the following
+            // references concurrently (see AccelerationStructure::updateReferences )
+            const auto load = [&](const std::vector<float> &values) {
+                return laneCount == F::Width ? F::load(&values[packet]) : F::loadPartial(&values[packet], laneCount);
+            };
+            const F v0[3] = { load(leaf.v0[0]), load(leaf.v0[1]), load(leaf.v0[2]) };
+            const F edge1[3] = { load(leaf.edge1[0]), load(leaf.edge1[1]), load(leaf.edge1[2]) };
+            const F edge2[3] = { load(leaf.edge2[0]), load(leaf.edge2[1]), load(leaf.edge2[2]) };
 
-            // calculate the face_normal vector of the hit point
-            Vector face_normal = v0v1.cross(v0v2).normalized();
-            
+            // hands the hits of a test of the packet to accept, where second has the bits of the lanes whose second
+            // triangle has been tested
+            const auto acceptHits = [&](int hits, const F &t, const F &u, const F &v, int second) {
+                return hits && acceptPacketHits<AnyHit>(hits, t, u, v,
+                    [&](int lane, float t_candidate, const Vector2 &uv_vector) {
+                        return accept(firstTriangle(referencedPrimitive(packet + lane)) + (second >> lane & 1),
+                            t_candidate, uv_vector);
+                    });
+            };
 
-            // Gouraud shading
-            if (m_smoothNormals) {
-                face_normal = Vertex::interpolate(uv_vector, v0 , v1, v2).normal.normalized();
+            F t, u, v;
+            if (m_quads.empty()) {
+                const int hits = intersectTrianglePacket(v0, edge1, edge2, origin, direction, its.t, t, u, v);
+                if (acceptHits(hits & lanes, t, u, v, 0)) {
+                    wasIntersected = true;
+                    if (AnyHit) {
+                        return true;
+                    }
+                }
+                continue;
             }
 
-            its.frame = Frame(face_normal);
-            its.uv = Vertex::interpolate(uv_vector, v0 , v1, v2).texcoords;
-            return true;
-        } else {
+            const F edge3[3] = { load(leaf.edge3[0]), load(leaf.edge3[1]), load(leaf.edge3[2]) };
+            int second, folded;
+            const int hits = intersectFacePacket(v0, edge1, edge2, edge3, origin, direction, its.t, t, u, v, second,
+                folded);
+            if (acceptHits(hits & lanes, t, u, v, second)) {
+                wasIntersected = true;
+                if (AnyHit) {
+                    return true;
+                }
+            }
+            folded &= lanes;
+            if (folded & second) {
+                // quads that fold over can be hit on both sides of the diagonal, hence the other triangle is tested too
+                const int hits = intersectTrianglePacket(v0, edge1, edge2, origin, direction, its.t, t, u, v);
+                if (acceptHits(hits & folded & second, t, u, v, 0)) {
+                    wasIntersected = true;
+                    if (AnyHit) {
+                        return true;
+                    }
+                }
+            }
+            if (folded & ~second) {
+                const int hits = intersectTrianglePacket(v0, edge2, edge3, origin, direction, its.t, t, u, v);
+                if (acceptHits(hits & folded & ~second, t, u, v, ~0)) {
+                    wasIntersected = true;
+                    if (AnyHit) {
+                        return true;
+                    }
+                }
+            }
+        }
+#else
+        for (int reference = first; reference < first + count; reference++) {
+            const int halves = leafFaceHalves(reference, ray);
+            for (int half = 0; half < 2; half++) {
+                float t;
+                Vector2 barycentrics;
+                if ((halves >> half & 1) && intersectLeafTriangle(reference, half, ray, its.t, t, barycentrics) &&
+                    accept(firstTriangle(referencedPrimitive(reference)) + half, t, barycentrics)) {
+                    wasIntersected = true;
+                    if (AnyHit) {
+                        return true;
+                    }
+                }
+            }
+        }
+#endif
+        return wasIntersected;
+    }
+
+    /**
+     * @brief Intersects all triangles of a cluster with a ray, like @ref intersectLeafTriangles , but gathers the
+     * positions of the triangles from the vertex list of the cluster.
+     * @param accept Called as @code accept(primitiveIndex, t, barycentrics) @endcode with the index of the triangle in
+     * @c m_triangles .
+     */
+    template <bool AnyHit, typename Accept>
+    bool intersectClusterTriangles(const Cluster &cluster, const Ray &ray, Intersection &its, Accept &&accept) const {
+        bool wasIntersected = false;
+        const std::array<uint8_t, 3> *indices = &m_clusterIndices[cluster.firstTriangle];
+        const Point *positions = &m_clusterPositions[cluster.firstVertex];
+#if defined(LW_BVH_SSE)
+        typedef SimdFloat F;
+        const F direction[3] = { F(ray.direction.x()), F(ray.direction.y()), F(ray.direction.z()) };
+        const F origin[3] = { F(ray.origin.x()), F(ray.origin.y()), F(ray.origin.z()) };
+
+        for (int packet = 0; packet < cluster.triangleCount; packet += F::Width) {
+            const int lanes = std::min(F::Width, cluster.triangleCount - packet);
+            float gathered[3][3][F::Width];
+            for (int lane = 0; lane < F::Width; lane++) {
+                // lanes past the end of the cluster repeat its last triangle, and are masked out
+                const std::array<uint8_t, 3> &triangle = indices[packet + std::min(lane, lanes - 1)];
+                for (int i = 0; i < 3; i++) {
+                    const Point &position = positions[triangle[i]];
+                    for (int dim = 0; dim < 3; dim++) {
+                        gathered[i][dim][lane] = position[dim];
+                    }
+                }
+            }
+
+            F v0[3], edge1[3], edge2[3];
+            for (int dim = 0; dim < 3; dim++) {
+                v0[dim] = F::load(gathered[0][dim]);
+                edge1[dim] = F::load(gathered[1][dim]) - v0[dim];
+                edge2[dim] = F::load(gathered[2][dim]) - v0[dim];
+            }
+
+            F t, u, v;
+            const int hits = intersectTrianglePacket(v0, edge1, edge2, origin, direction, its.t, t, u, v) &
+                ((1 << lanes) - 1);
+            if (hits && acceptPacketHits<AnyHit>(hits, t, u, v,
+                    [&](int lane, float t_candidate, const Vector2 &uv_vector) {
+                        return accept(m_clusterTriangles[cluster.firstTriangle + packet + lane], t_candidate,
+                            uv_vector);
+                    })) {
+                wasIntersected = true;
+                if (AnyHit) {
+                    return true;
+                }
+            }
+        }
+#else
+        for (int triangle = 0; triangle < cluster.triangleCount; triangle++) {
+            const Point &p0 = positions[indices[triangle][0]];
+            float t;
+            Vector2 barycentrics;
+            if (intersectTriangle(p0, positions[indices[triangle][1]] - p0, positions[indices[triangle][2]] - p0,
+                    ray, its.t, t, barycentrics) &&
+                accept(m_clusterTriangles[cluster.firstTriangle + triangle], t, barycentrics)) {
+                wasIntersected = true;
+                if (AnyHit) {
+                    return true;
+                }
+            }
+        }
+#endif
+        return wasIntersected;
+    }
+
+    /// @brief Intersects the clusters of a leaf with a ray (see @ref intersectClusterTriangles ).
+    template <bool AnyHit, typename Accept>
+    bool intersectLeafClusters(int first, int count, const Ray &ray, Intersection &its, Accept &&accept) const {
+        bool wasIntersected = false;
+        for (int reference = first; reference < first + count; reference++) {
+            if (intersectClusterTriangles<AnyHit>(m_clusters[referencedPrimitive(reference)], ray, its, accept)) {
+                wasIntersected = true;
+                if (AnyHit) {
+                    return true;
+                }
+            }
+        }
+        return wasIntersected;
+    }
+
+    /// @brief Interpolates the texture coordinates of a triangle at the given barycentric coordinates.
+    Point2 interpolateTexcoords(int primitiveIndex, const Vector2 &barycentrics) const {
+        const Vector3i vertices_indices = triangleVertices(primitiveIndex);
+        return interpolateBarycentric(barycentrics,
+            m_vertices[vertices_indices.x()].texcoords,
+            m_vertices[vertices_indices.y()].texcoords,
+            m_vertices[vertices_indices.z()].texcoords
+        );
+    }
+
+    /**
+     * @brief Records a hit of a triangle, unless the hit is dismissed by the alpha mask.
+     * The surface attributes are only computed for the closest hit, see @ref populateIntersection .
+     * @return Whether the hit has been accepted.
+     */
+    bool acceptHit(int primitiveIndex, float t_candidate, const Vector2 &uv_vector,
+                   Intersection &its, Sampler &rng) const {
+        // valid alpha_mask value
+        // check if the intersection still occurs
+        if (isTransparent(primitiveIndex, uv_vector, its, rng)) {
             return false;
         }
+        its.t = t_candidate;
+        its.deferredShape = this;
+        its.instance = nullptr;
+        its.primitiveIndex = primitiveIndex;
+        its.barycentrics = uv_vector;
+        return true;
+    }
+
+    /// @brief Accepts a hit of a triangle for shadow rays, unless it is dismissed by the alpha mask.
+    bool acceptOcclusion(int primitiveIndex, float t_candidate, const Vector2 &uv_vector,
+                         Intersection &its, Sampler &rng) const {
+        // texture coordinates are only needed to evaluate the alpha mask
+        if (isTransparent(primitiveIndex, uv_vector, its, rng)) {
+            return false;
+        }
+        its.t = t_candidate;
+        // triangles that block every ray can be tested first by the next shadow rays
+        its.occluder = isOpaque(primitiveIndex, its) ? Occluder { nullptr, this, primitiveIndex } : Occluder {};
+        return true;
+    }
+
+    bool intersect(int primitiveIndex, const Ray &ray, Intersection &its, Sampler &rng) const override {
+        if (m_clusterSize > 0) {
+            return intersectClusterTriangles<false>(m_clusters[primitiveIndex], ray, its,
+                [&](int triangle, float t_candidate, const Vector2 &uv_vector) {
+                    return acceptHit(triangle, t_candidate, uv_vector, its, rng);
+                });
+        }
+        // without clusters, the primitives are faces
+        bool wasIntersected = false;
+        const int first = firstTriangle(primitiveIndex);
+        for (int triangle = first; triangle < first + faceTriangleCount(primitiveIndex); triangle++) {
+            float t_candidate;
+            Vector2 uv_vector;
+            if (intersectTriangle(triangle, ray, its.t, t_candidate, uv_vector) &&
+                acceptHit(triangle, t_candidate, uv_vector, its, rng)) {
+                wasIntersected = true;
+            }
+        }
+        return wasIntersected;
+    }
+
+    bool occluded(int primitiveIndex, const Ray &ray, Intersection &its, Sampler &rng) const override {
+        if (m_clusterSize > 0) {
+            return intersectClusterTriangles<true>(m_clusters[primitiveIndex], ray, its,
+                [&](int triangle, float t_candidate, const Vector2 &uv_vector) {
+                    return acceptOcclusion(triangle, t_candidate, uv_vector, its, rng);
+                });
+        }
+        const int first = firstTriangle(primitiveIndex);
+        for (int triangle = first; triangle < first + faceTriangleCount(primitiveIndex); triangle++) {
+            float t_candidate;
+            Vector2 uv_vector;
+            if (intersectTriangle(triangle, ray, its.t, t_candidate, uv_vector) &&
+                acceptOcclusion(triangle, t_candidate, uv_vector, its, rng)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool occludedPrimitive(int primitiveIndex, const Ray &ray, Intersection &its, Sampler &rng) const override {
+        // occluders are always triangles, also when the BVH is built over clusters
+        float t_candidate;
+        Vector2 uv_vector;
+        return intersectTriangle(primitiveIndex, ray, its.t, t_candidate, uv_vector) &&
+            acceptOcclusion(primitiveIndex, t_candidate, uv_vector, its, rng);
+    }
+
+    void updateReferences(int first, int count) override {
+        LeafTriangles &leaf = m_leafTriangles;
+        if (m_clusterSize > 0) {
+            // traversal reads the positions from the clusters instead
+            leaf = {};
+            return;
+        }
+        if (leaf.v0[0].size() != size_t(referenceCount())) {
+            for (int dim = 0; dim < 3; dim++) {
+                leaf.v0[dim].assign(referenceCount(), 0);
+                leaf.edge1[dim].assign(referenceCount(), 0);
+                leaf.edge2[dim].assign(referenceCount(), 0);
+                if (!m_quads.empty()) {
+                    leaf.edge3[dim].assign(referenceCount(), 0);
+                }
+            }
+        }
+
+        for (int reference = first; reference < first + count; reference++) {
+            const int faceIndex = referencedPrimitive(reference);
+            const Vector3i vertices_indices = triangleVertices(firstTriangle(faceIndex));
+            const Point &p0 = m_vertices[vertices_indices.x()].position;
+            const Vector v0v1 = m_vertices[vertices_indices.y()].position - p0;
+            const Vector v0v2 = m_vertices[vertices_indices.z()].position - p0;
+            for (int dim = 0; dim < 3; dim++) {
+                leaf.v0[dim][reference] = p0[dim];
+                leaf.edge1[dim][reference] = v0v1[dim];
+                leaf.edge2[dim][reference] = v0v2[dim];
+            }
+            if (!m_quads.empty()) {
+                // the second triangle of a quad shares the first vertex and the diagonal with the first one
+                const Vector v0v3 = faceTriangleCount(faceIndex) == 2
+                    ? m_vertices[triangleVertices(firstTriangle(faceIndex) + 1).z()].position - p0
+                    : Vector(0);
+                for (int dim = 0; dim < 3; dim++) {
+                    leaf.edge3[dim][reference] = v0v3[dim];
+                }
+            }
+        }
+    }
 
+    bool updateFrame(int frame) override {
+        if (m_sequence.empty()) {
+            return false;
+        }
 
-        // hints:
-        // * use m_triangles[primitiveIndex] to get the vertex indices of the triangle that should be intersected
-        // * if m_smoothNormals is true, interpolate the vertex normals from m_vertices
-        //   * make sure that your shading frame stays orthonormal!
-        // * if m_smoothNormals is false, use the geometrical normal (can be computed from the vertex positions)
+        std::vector<Vector3i> triangles;
+        std::vector<Vector4i> quads;
+        std::vector<Vertex> vertices;
+        m_originalPath = tfm::format(m_sequence.c_str(), frame);
+        readPLY(m_originalPath.string(), triangles, vertices, m_splitQuads ? nullptr : &quads);
+        // the mesh deforms in place, which allows refitting the BVH instead of rebuilding it
+        if (triangles != m_triangles || quads != m_quads) {
+            lightwave_throw("frame %d of mesh sequence \"%s\" does not have the same triangles as the previous frames",
+                frame, m_sequence);
+        }
+        m_vertices = std::move(vertices);
+        updateClusterPositions();
+        return true;
+    }
+
+    bool canBeHit(int primitiveIndex) const override {
+        // clusters only contain triangles that are kept
+        return m_clusterSize > 0 || isFaceKept(primitiveIndex);
     }
 
     Bounds getBoundingBox(int primitiveIndex) const override {
-        Vector3i vertices_indices = m_triangles[primitiveIndex];
+        if (m_clusterSize > 0) {
+            const Cluster &cluster = m_clusters[primitiveIndex];
+            Bounds result = Bounds::empty();
+            for (int vertex = cluster.firstVertex; vertex < cluster.firstVertex + cluster.vertexCount; vertex++) {
+                result.extend(m_clusterPositions[vertex]);
+            }
+            return result;
+        }
+        Bounds result = getTriangleBoundingBox(firstTriangle(primitiveIndex));
+        if (faceTriangleCount(primitiveIndex) == 2) {
+            result.extend(getTriangleBoundingBox(firstTriangle(primitiveIndex) + 1));
+        }
+        return result;
+    }
+
+    Bounds getClippedBoundingBox(int primitiveIndex, const Bounds &clip) const override {
+        if (m_clusterSize > 0) {
+            const Cluster &cluster = m_clusters[primitiveIndex];
+            Bounds result = Bounds::empty();
+            for (int triangle = cluster.firstTriangle; triangle < cluster.firstTriangle + cluster.triangleCount;
+                 triangle++) {
+                result.extend(getClippedTriangleBoundingBox(m_clusterTriangles[triangle], clip));
+            }
+            return result;
+        }
+        Bounds result = getClippedTriangleBoundingBox(firstTriangle(primitiveIndex), clip);
+        if (faceTriangleCount(primitiveIndex) == 2) {
+            result.extend(getClippedTriangleBoundingBox(firstTriangle(primitiveIndex) + 1, clip));
+        }
+        return result;
+    }
+
+    Point getCentroid(int primitiveIndex) const override {
+        if (m_clusterSize > 0) {
+            return getBoundingBox(primitiveIndex).center();
+        }
+        if (faceTriangleCount(primitiveIndex) == 2) {
+            // the average of the four vertices of the quad
+            const Vector4i &quad = m_quads[primitiveIndex - int(m_triangles.size())];
+            Vector sum(0);
+            for (int i = 0; i < 4; i++) {
+                sum += m_vertices[quad[i]].position - Point(0);
+            }
+            return Point(0) + sum / 4;
+        }
+        return getTriangleCentroid(primitiveIndex);
+    }
+
+    /// @brief Returns the bounding box of a triangle.
+    Bounds getTriangleBoundingBox(int primitiveIndex) const {
+        Vector3i vertices_indices = triangleVertices(primitiveIndex);
         Vertex p1 = m_vertices[vertices_indices.x()];
         Vertex p2 = m_vertices[vertices_indices.y()];
         Vertex p3 = m_vertices[vertices_indices.z()];
@@ -150,11 +1051,63 @@ protected:
         return Bounds(Point{min_x, min_y, min_z}, Point{max_x, max_y, max_z});
     }
 
-    Point getCentroid(int primitiveIndex) const override {
+    /// @brief Returns the bounding box of the part of a triangle that lies within @c clip .
+    Bounds getClippedTriangleBoundingBox(int primitiveIndex, const Bounds &clip) const {
+        // clip the triangle against all six planes of the box (Sutherland-Hodgman),
+        // every plane can add at most one vertex to the polygon
+        Point polygon[9], clipped[9];
+        int vertexCount = 3;
+        const Vector3i vertices_indices = triangleVertices(primitiveIndex);
+        for (int i = 0; i < 3; i++) {
+            polygon[i] = m_vertices[vertices_indices[i]].position;
+        }
+
+        for (int dim = 0; dim < 3; dim++) {
+            for (int side = 0; side < 2; side++) {
+                const float plane = side == 0 ? clip.min()[dim] : clip.max()[dim];
+                const auto inside = [&](const Point &p) {
+                    return side == 0 ? p[dim] >= plane : p[dim] <= plane;
+                };
+
+                int clippedCount = 0;
+                for (int i = 0; i < vertexCount; i++) {
+                    const Point &current = polygon[i];
+                    const Point &next = polygon[(i + 1) % vertexCount];
+                    if (inside(current)) {
+                        clipped[clippedCount++] = current;
+                    }
+                    if (inside(current) != inside(next)) {
+                        const float t = (plane - current[dim]) / (next[dim] - current[dim]);
+                        Point intersection = current + t * (next - current);
+                        intersection[dim] = plane;
+                        clipped[clippedCount++] = intersection;
+                    }
+                }
+
+                vertexCount = clippedCount;
+                if (vertexCount == 0) {
+                    // the triangle does not overlap the box
+                    return Bounds::empty();
+                }
+                std::copy(clipped, clipped + vertexCount, polygon);
+            }
+        }
+
+        Bounds result = Bounds::empty();
+        for (int i = 0; i < vertexCount; i++) {
+            result.extend(polygon[i]);
+        }
+        // guard against rounding errors of the intersection points
+        return clip.clip(result);
+    }
+
+    /// @brief Returns the centroid of a triangle.
+    Point getTriangleCentroid(int primitiveIndex) const {
         // (A_x + B_x + C_x) / 3, (A_y + B_y + C_y) / 3 ...
-        Vertex A = m_vertices[m_triangles[primitiveIndex].x()];
-        Vertex B = m_vertices[m_triangles[primitiveIndex].y()];
-        Vertex C = m_vertices[m_triangles[primitiveIndex].z()];
+        const Vector3i vertices_indices = triangleVertices(primitiveIndex);
+        Vertex A = m_vertices[vertices_indices.x()];
+        Vertex B = m_vertices[vertices_indices.y()];
+        Vertex C = m_vertices[vertices_indices.z()];
         
         float x = (A.position.x() + B.position.x() + C.position.x()) / 3;
         float y = (A.position.y() + B.position.y() + C.position.y()) / 3;
@@ -163,21 +1116,157 @@ protected:
     }
 
 public:
-    TriangleMesh(const Properties &properties) {
-        m_originalPath = properties.get<std::filesystem::path>("filename");
+    TriangleMesh(const Properties &properties)
+    : AccelerationStructure(properties) {
+        if (properties.has("sequence")) {
+            m_sequence = (properties.basePath() / properties.get<std::string>("sequence")).string();
+            m_originalPath = tfm::format(m_sequence.c_str(), 0);
+        } else {
+            m_originalPath = properties.get<std::filesystem::path>("filename");
+        }
         m_smoothNormals = properties.get<bool>("smooth", true);
-        readPLY(m_originalPath.string(), m_triangles, m_vertices);
-        logger(EInfo, "loaded ply with %d triangles, %d vertices",
+        // quads are intersected as such unless they are split into triangles while loading
+        m_splitQuads = !properties.get<bool>("quads", true);
+        readPLY(m_originalPath.string(), m_triangles, m_vertices, m_splitQuads ? nullptr : &m_quads);
+        logger(EInfo, "loaded ply with %d triangles, %d quads, %d vertices",
             m_triangles.size(),
+            m_quads.size(),
             m_vertices.size()
         );
-        buildAccelerationStructure();
+        // groups triangles into clusters of (at most) this size, over which the BVH is built
+        m_clusterSize = properties.get<int>("clusterSize", 0);
+        if (m_clusterSize < 0 || m_clusterSize > MaxClusterSize) {
+            lightwave_throw("the cluster size must be between 0 (no clusters) and %d", MaxClusterSize);
+        }
+        // the BVH is only built once the mesh is attached to the scene, as alpha masks can leave triangles out
+        m_vertexBounds = Bounds::empty();
+        for (const Vertex &vertex : m_vertices) {
+            m_vertexBounds.extend(vertex.position);
+        }
     }
 
     bool intersect(const Ray &ray, Intersection &its,
                    Sampler &rng) const override {
         PROFILE("Triangle mesh")
-        return AccelerationStructure::intersect(ray, its, rng);
+        return intersectChildren(ray, its, rng);
+    }
+
+    bool occluded(const Ray &ray, Intersection &its,
+                  Sampler &rng) const override {
+        PROFILE("Triangle mesh")
+        return occludedChildren(ray, its, rng);
+    }
+
+    bool intersectChildren(const Ray &ray, Intersection &its, Sampler &rng) const override {
+        // non-virtual calls, so that the triangle test is inlined into the leaf loops, and only hits need to look up
+        // the triangle in the index buffer
+        const auto accept = [&](int primitiveIndex, float t_candidate, const Vector2 &uv_vector) {
+            return acceptHit(primitiveIndex, t_candidate, uv_vector, its, rng);
+        };
+        return intersectLeaves<false>(ray, its, [&](int first, int count) {
+            if (m_clusterSize > 0) {
+                return intersectLeafClusters<false>(first, count, ray, its, accept);
+            }
+            return intersectLeafTriangles<false>(first, count, ray, its, accept);
+        });
+    }
+
+    bool occludedChildren(const Ray &ray, Intersection &its, Sampler &rng) const override {
+        const auto accept = [&](int primitiveIndex, float t_candidate, const Vector2 &uv_vector) {
+            return acceptOcclusion(primitiveIndex, t_candidate, uv_vector, its, rng);
+        };
+        return intersectLeaves<true>(ray, its, [&](int first, int count) {
+            if (m_clusterSize > 0) {
+                return intersectLeafClusters<true>(first, count, ray, its, accept);
+            }
+            return intersectLeafTriangles<true>(first, count, ray, its, accept);
+        });
+    }
+
+    RayMask intersectPacket(const Ray *rays, Intersection *its, Sampler *const *rngs,
+                            RayMask active) const override {
+        return intersectLeavesPacket(rays, its, active, [&](int first, int count, RayMask leafRays) {
+            RayMask hits = 0;
+            for (; leafRays; leafRays &= leafRays - 1) {
+                const int index = std::countr_zero(leafRays);
+                const auto accept = [&](int primitiveIndex, float t_candidate, const Vector2 &uv_vector) {
+                    return acceptHit(primitiveIndex, t_candidate, uv_vector, its[index], *rngs[index]);
+                };
+                const bool wasIntersected = m_clusterSize > 0
+                    ? intersectLeafClusters<false>(first, count, rays[index], its[index], accept)
+                    : intersectLeafTriangles<false>(first, count, rays[index], its[index], accept);
+                if (wasIntersected) {
+                    hits |= RayMask(1) << index;
+                }
+            }
+            return hits;
+        });
+    }
+
+    void attachAlphaMask(const Texture *alphaMask) override {
+        if (!m_hasInstances) {
+            m_hasInstances = true;
+            m_sharedAlphaMask = alphaMask;
+            // deforming meshes are not classified, as their texture coordinates could change with every frame
+            const bool hasTransparent = alphaMask && m_sequence.empty() && classifyOpacity(*alphaMask) > 0;
+            // the BVH has only been built already if the mesh is also part of the scene without an instance
+            if (hasTransparent || !m_hasBVH) {
+                buildBVH();
+            }
+            return;
+        }
+        if (alphaMask == m_sharedAlphaMask) {
+            return;
+        }
+
+        // instances with different alpha masks share this mesh, hence every triangle needs to be kept
+        const bool hasTransparent =
+            std::find(m_opacity.begin(), m_opacity.end(), Opacity::Transparent) != m_opacity.end();
+        m_sharedAlphaMask = nullptr;
+        m_opacity.clear();
+        if (hasTransparent) {
+            buildBVH();
+        }
+    }
+
+    void markAsVisible() override {
+        if (!m_hasBVH) {
+            buildBVH();
+        }
+    }
+
+    Bounds getBoundingBox() const override {
+        // groups query the bounds of their children while loading, which can be before the mesh is attached
+        return m_hasBVH ? AccelerationStructure::getBoundingBox() : m_vertexBounds;
+    }
+
+    Point getCentroid() const override {
+        return getBoundingBox().center();
+    }
+
+    void populateIntersection(Intersection &its) const override {
+        const Vector3i vertices_indices = triangleVertices(its.primitiveIndex);
+        const Vertex &v0 = m_vertices[vertices_indices.x()];
+        const Vertex &v1 = m_vertices[vertices_indices.y()];
+        const Vertex &v2 = m_vertices[vertices_indices.z()];
+
+        const Vertex interpolated = Vertex::interpolate(its.barycentrics, v0, v1, v2);
+        its.position = interpolated.position;
+
+        // calculate the face_normal vector of the hit point
+        Vector face_normal = (v1.position - v0.position).cross(v2.position - v0.position).normalized();
+
+        // Gouraud shading
+        if (m_smoothNormals) {
+            face_normal = interpolated.normal.normalized();
+        }
+
+        its.frame = Frame(face_normal);
+        its.uv = interpolated.texcoords;
+    }
+
+    std::string describe() const override {
+        return tfm::format("mesh \"%s\"", m_originalPath.filename().string());
     }
 
     AreaSample sampleArea(Sampler &rng) const override {
@@ -194,10 +1283,12 @@ public:
             "Mesh[\n"
             "  vertices = %d,\n"
             "  triangles = %d,\n"
+            "  quads = %d,\n"
             "  filename = \"%s\"\n"
             "]",
             m_vertices.size(),
             m_triangles.size(),
+            m_quads.size(),
             m_originalPath.generic_string()
         );
     }
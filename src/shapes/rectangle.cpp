@@ -57,6 +57,7 @@ public:
 
         // we have determined there was an intersection! we are now free to change the intersection object and return true.
         its.t = t;
+        its.deferredShape = nullptr;
         populate(its, position); // compute the shading frame, texture coordinates and area pdf (same as sampleArea)
         return true;
     }
@@ -0,0 +1,101 @@
+#pragma once
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define LW_BVH_SSE
+#endif
+#if defined(__AVX__)
+#define LW_BVH_AVX
+#endif
+
+namespace lightwave
+{
+
+#if defined(LW_BVH_SSE)
+    /**
+     * @brief A minimal wrapper around the widest float vector the target
+     * supports (8 lanes with AVX, 4 lanes with SSE), used to test several
+     * primitives against the same ray at once.
+     * @note Comparisons return masks, whose lanes have all bits set where the
+     * comparison holds.
+     */
+    struct SimdFloat
+    {
+#if defined(LW_BVH_AVX)
+        /// @brief The number of lanes.
+        static constexpr int Width = 8;
+        typedef __m256 Register;
+#else
+        /// @brief The number of lanes.
+        static constexpr int Width = 4;
+        typedef __m128 Register;
+#endif
+        Register v;
+
+        SimdFloat() = default;
+        SimdFloat(Register v) : v(v) {}
+
+#if defined(LW_BVH_AVX)
+        /// @brief Broadcasts a value to all lanes.
+        explicit SimdFloat(float value) : v(_mm256_set1_ps(value)) {}
+        /// @brief Loads @c Width consecutive values (without alignment requirements).
+        static SimdFloat load(const float *values) { return _mm256_loadu_ps(values); }
+        /// @brief Loads the first @c count values into the first lanes, and zeros the others (without reading past
+        /// the first @c count values).
+        static SimdFloat loadPartial(const float *values, int count) {
+            const __m256 lanes = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+            const __m256 mask = _mm256_cmp_ps(lanes, _mm256_set1_ps(float(count)), _CMP_LT_OQ);
+            return _mm256_maskload_ps(values, _mm256_castps_si256(mask));
+        }
+        /// @brief Stores all lanes to @c Width consecutive values.
+        void store(float *values) const { _mm256_storeu_ps(values, v); }
+        /// @brief Returns a bitmask of the lanes whose sign bit is set (e.g., of a comparison mask).
+        int mask() const { return _mm256_movemask_ps(v); }
+        /// @brief Picks the lanes of @c a where @c mask is set, and those of @c b elsewhere.
+        static SimdFloat select(SimdFloat mask, SimdFloat a, SimdFloat b) {
+            return _mm256_blendv_ps(b.v, a.v, mask.v);
+        }
+
+        friend SimdFloat operator+(SimdFloat a, SimdFloat b) { return _mm256_add_ps(a.v, b.v); }
+        friend SimdFloat operator-(SimdFloat a, SimdFloat b) { return _mm256_sub_ps(a.v, b.v); }
+        friend SimdFloat operator*(SimdFloat a, SimdFloat b) { return _mm256_mul_ps(a.v, b.v); }
+        friend SimdFloat operator/(SimdFloat a, SimdFloat b) { return _mm256_div_ps(a.v, b.v); }
+        friend SimdFloat operator<(SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+        friend SimdFloat operator>(SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+        friend SimdFloat operator&(SimdFloat a, SimdFloat b) { return _mm256_and_ps(a.v, b.v); }
+        friend SimdFloat operator|(SimdFloat a, SimdFloat b) { return _mm256_or_ps(a.v, b.v); }
+#else
+        /// @brief Broadcasts a value to all lanes.
+        explicit SimdFloat(float value) : v(_mm_set1_ps(value)) {}
+        /// @brief Loads @c Width consecutive values (without alignment requirements).
+        static SimdFloat load(const float *values) { return _mm_loadu_ps(values); }
+        /// @brief Loads the first @c count values into the first lanes, and zeros the others (without reading past
+        /// the first @c count values).
+        static SimdFloat loadPartial(const float *values, int count) {
+            float lanes[Width] = {};
+            for (int lane = 0; lane < count; lane++)
+                lanes[lane] = values[lane];
+            return _mm_loadu_ps(lanes);
+        }
+        /// @brief Stores all lanes to @c Width consecutive values.
+        void store(float *values) const { _mm_storeu_ps(values, v); }
+        /// @brief Returns a bitmask of the lanes whose sign bit is set (e.g., of a comparison mask).
+        int mask() const { return _mm_movemask_ps(v); }
+        /// @brief Picks the lanes of @c a where @c mask is set, and those of @c b elsewhere.
+        static SimdFloat select(SimdFloat mask, SimdFloat a, SimdFloat b) {
+            return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+        }
+
+        friend SimdFloat operator+(SimdFloat a, SimdFloat b) { return _mm_add_ps(a.v, b.v); }
+        friend SimdFloat operator-(SimdFloat a, SimdFloat b) { return _mm_sub_ps(a.v, b.v); }
+        friend SimdFloat operator*(SimdFloat a, SimdFloat b) { return _mm_mul_ps(a.v, b.v); }
+        friend SimdFloat operator/(SimdFloat a, SimdFloat b) { return _mm_div_ps(a.v, b.v); }
+        friend SimdFloat operator<(SimdFloat a, SimdFloat b) { return _mm_cmplt_ps(a.v, b.v); }
+        friend SimdFloat operator>(SimdFloat a, SimdFloat b) { return _mm_cmpgt_ps(a.v, b.v); }
+        friend SimdFloat operator&(SimdFloat a, SimdFloat b) { return _mm_and_ps(a.v, b.v); }
+        friend SimdFloat operator|(SimdFloat a, SimdFloat b) { return _mm_or_ps(a.v, b.v); }
+#endif
+    };
+#endif
+
+}
@@ -108,6 +108,7 @@ namespace lightwave
                 }
             }
             its.t = t_candidate;
+            its.deferredShape = nullptr;
             populate(its,position_hit_point);
             // calculate the normal vector of the hit point
             
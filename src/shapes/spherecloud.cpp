@@ -0,0 +1,364 @@
+#include <lightwave.hpp>
+
+#include "../core/plyparser.hpp"
+#include "accel.hpp"
+
+#include <fstream>
+
+namespace lightwave {
+
+/**
+ * @brief A shape consisting of many (potentially millions) of spheres, e.g., particles or debris.
+ * Instantiating the unit @c sphere for each of them would cost a transform, several shared pointers and a chain of
+ * virtual calls per sphere. Instead, the cloud only stores the centers and radii of its spheres (with a separate array
+ * per component), builds a BVH over them, and intersects them in its own coordinates.
+ * Spheres can select among the materials of the instance that wraps the cloud (see @ref Intersection::materialIndex ).
+ */
+class SphereCloud final : public AccelerationStructure {
+    /// @brief The centers of the spheres, with a separate array per component.
+    std::vector<float> m_centers[3];
+    /// @brief The radius of every sphere, or empty if all spheres have the radius @c m_radius .
+    std::vector<float> m_radii;
+    /// @brief The radius of all spheres, if they do not have individual radii.
+    float m_radius;
+    /// @brief The material index of every sphere, or empty if all spheres use the first material of the instance.
+    std::vector<uint16_t> m_materials;
+    /// @brief The file the spheres were loaded from, for logging and debugging purposes.
+    std::filesystem::path m_originalPath;
+
+    int sphereCount() const {
+        return int(m_centers[0].size());
+    }
+
+    Point center(int sphere) const {
+        return { m_centers[0][sphere], m_centers[1][sphere], m_centers[2][sphere] };
+    }
+
+    float radius(int sphere) const {
+        return m_radii.empty() ? m_radius : m_radii[sphere];
+    }
+
+    /**
+     * @brief Loads the spheres from a raw binary file, which consists of one record of four little endian 32-bit
+     * floats (the center followed by the radius) per sphere.
+     */
+    void readRawSpheres(const std::filesystem::path &path) {
+        logger(EInfo, "loading spheres %s", path);
+        std::ifstream stream(path, std::ios::binary | std::ios::ate);
+        if (!stream) {
+            lightwave_throw("error opening file %s", path);
+        }
+        const std::streamsize size = stream.tellg();
+        if (size % (4 * sizeof(float)) != 0) {
+            lightwave_throw("the size of %s is not a multiple of the size of a sphere (16 bytes)", path);
+        }
+        stream.seekg(0);
+
+        const int count = int(size / (4 * sizeof(float)));
+        for (int dim = 0; dim < 3; dim++) {
+            m_centers[dim].resize(count);
+        }
+        m_radii.resize(count);
+
+        // read the spheres in blocks, to avoid holding the whole file in memory
+        constexpr int BlockSize = 65536;
+        std::vector<float> block(4 * BlockSize);
+        for (int first = 0; first < count; first += BlockSize) {
+            const int blockCount = std::min(BlockSize, count - first);
+            if (!stream.read(reinterpret_cast<char *>(block.data()), std::streamsize(blockCount) * 4 * sizeof(float))) {
+                lightwave_throw("error reading %s", path);
+            }
+            for (int i = 0; i < blockCount; i++) {
+                for (int dim = 0; dim < 3; dim++) {
+                    m_centers[dim][first + i] = block[4 * i + dim];
+                }
+                m_radii[first + i] = block[4 * i + 3];
+            }
+        }
+    }
+
+    /**
+     * @brief Sorts the spheres along a Morton curve, so that spheres that are close in space are also close in memory,
+     * which keeps the leaves of the BVH from loading their spheres from all over the arrays.
+     */
+    void sortSpheres() {
+        const int count = sphereCount();
+        Bounds bounds = Bounds::empty();
+        for (int sphere = 0; sphere < count; sphere++) {
+            bounds.extend(center(sphere));
+        }
+
+        constexpr float GridSize = float(1 << MortonBits);
+        float scale[3];
+        for (int dim = 0; dim < 3; dim++) {
+            const float extent = bounds.max()[dim] - bounds.min()[dim];
+            scale[dim] = extent > 0 ? GridSize / extent : 0;
+        }
+
+        std::vector<uint64_t> codes(count);
+        std::vector<int> order(count);
+        std::iota(order.begin(), order.end(), 0);
+        for (int sphere = 0; sphere < count; sphere++) {
+            uint32_t cell[3];
+            for (int dim = 0; dim < 3; dim++) {
+                // written so that NaNs map to 0
+                const float offset = (m_centers[dim][sphere] - bounds.min()[dim]) * scale[dim];
+                cell[dim] = offset > 0 ? uint32_t(std::min(offset, GridSize - 1)) : 0;
+            }
+            codes[sphere] = mortonCode(cell[0], cell[1], cell[2]);
+        }
+        radixSort(codes, order, 3 * MortonBits);
+        codes = {};
+
+        const auto permute = [&](auto &values) {
+            if (values.empty()) {
+                return;
+            }
+            std::remove_reference_t<decltype(values)> sorted(count);
+            for (int i = 0; i < count; i++) {
+                sorted[i] = values[order[i]];
+            }
+            values.swap(sorted);
+        };
+        for (int dim = 0; dim < 3; dim++) {
+            permute(m_centers[dim]);
+        }
+        permute(m_radii);
+        permute(m_materials);
+    }
+
+    /**
+     * @brief Intersects a sphere with a ray, and hands its hits to @c accept from the closest to the farthest, until
+     * one is accepted.
+     * @param accept Called as @code accept(t) @endcode for hits closer than @c tMax , and returns whether the hit has
+     * been accepted (e.g., is not dismissed by an alpha mask).
+     */
+    template <typename Accept>
+    bool intersectSphere(int sphere, const Ray &ray, float tMax, Accept &&accept) const {
+        // self intersections
+        constexpr float Epsilon = 1e-4f;
+
+        const Vector oc = ray.origin - center(sphere);
+        const float r = radius(sphere);
+        const float a = ray.direction.lengthSquared();
+        const float b = oc.dot(ray.direction);
+        const float c = oc.lengthSquared() - r * r;
+
+        // the discriminant is computed from the distance between the center and the ray, which is more precise for
+        // small spheres far away than b^2 - a * c (see "Precision Improvements for Ray/Sphere Intersection" in Ray
+        // Tracing Gems)
+        const Vector f = oc - (b / a) * ray.direction;
+        const float discriminant = a * (r * r - f.lengthSquared());
+        if (discriminant < 0) {
+            return false;
+        }
+
+        // avoids cancellation for the root that is computed by adding numbers of the same sign
+        const float q = -b - std::copysign(std::sqrt(discriminant), b);
+        float t0 = c / q;
+        float t1 = q / a;
+        if (t0 > t1) {
+            std::swap(t0, t1);
+        }
+
+        for (const float t : { t0, t1 }) {
+            if (t > Epsilon && t < tMax && accept(t)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /// @brief Encodes a unit vector as point of the octahedron that is unfolded onto [-1,1]^2.
+    static Vector2 encodeOctahedral(const Vector &n) {
+        const float l1 = std::abs(n.x()) + std::abs(n.y()) + std::abs(n.z());
+        const float x = n.x() / l1, y = n.y() / l1;
+        if (n.z() >= 0) {
+            return { x, y };
+        }
+        return { (1 - std::abs(y)) * (x >= 0 ? 1.f : -1.f), (1 - std::abs(x)) * (y >= 0 ? 1.f : -1.f) };
+    }
+
+    /// @brief Decodes a unit vector from @ref encodeOctahedral .
+    static Vector decodeOctahedral(const Vector2 &p) {
+        Vector n { p.x(), p.y(), 1 - std::abs(p.x()) - std::abs(p.y()) };
+        if (n.z() < 0) {
+            n.x() = (1 - std::abs(p.y())) * (p.x() >= 0 ? 1.f : -1.f);
+            n.y() = (1 - std::abs(p.x())) * (p.y() >= 0 ? 1.f : -1.f);
+        }
+        return n.normalized();
+    }
+
+    /**
+     * @brief Populates the surface attributes of a point on a sphere, used by @ref populateIntersection and
+     * @ref sampleArea (same as for the unit @c sphere ).
+     */
+    void populate(SurfaceEvent &surf, int sphere, const Vector &normal) const {
+        surf.position = center(sphere) + radius(sphere) * normal;
+        float u = 0.5 + (atan2(normal.x(), normal.z()) / (2 * Pi));
+        float v = 0.5 - (asin(std::clamp(normal.y(), -1.f, 1.f)) / Pi);
+        surf.uv = Point2(u, v);
+        surf.frame = Frame(normal);
+        // the pdf of sampling the point, when picking one of the spheres uniformly
+        surf.pdf = Inv4Pi / (sqr(radius(sphere)) * sphereCount());
+    }
+
+    /// @brief Stochastically decides whether a hit is dismissed by the alpha mask of the intersection (if any).
+    bool isTransparent(int sphere, const Ray &ray, float t, const Intersection &its, Sampler &rng) const {
+        if (its.alpha_mask == nullptr) {
+            return false;
+        }
+        SurfaceEvent surf;
+        populate(surf, sphere, (ray(t) - center(sphere)).normalized());
+        return its.alpha_mask->evaluate(surf.uv).r() < rng.next();
+    }
+
+protected:
+    int numberOfPrimitives() const override {
+        return sphereCount();
+    }
+
+    bool intersect(int primitiveIndex, const Ray &ray, Intersection &its, Sampler &rng) const override {
+        return intersectSphere(primitiveIndex, ray, its.t, [&](float t) {
+            if (isTransparent(primitiveIndex, ray, t, its, rng)) {
+                return false;
+            }
+            // the surface attributes are only computed for the closest hit, see populateIntersection
+            its.t = t;
+            its.deferredShape = this;
+            its.instance = nullptr;
+            its.primitiveIndex = primitiveIndex;
+            its.barycentrics = encodeOctahedral((ray(t) - center(primitiveIndex)).normalized());
+            return true;
+        });
+    }
+
+    bool occluded(int primitiveIndex, const Ray &ray, Intersection &its, Sampler &rng) const override {
+        return intersectSphere(primitiveIndex, ray, its.t, [&](float t) {
+            if (isTransparent(primitiveIndex, ray, t, its, rng)) {
+                return false;
+            }
+            its.t = t;
+            // spheres that block every ray can be tested first by the next shadow rays
+            its.occluder = its.alpha_mask ? Occluder {} : Occluder { nullptr, this, primitiveIndex };
+            return true;
+        });
+    }
+
+    bool occludedPrimitive(int primitiveIndex, const Ray &ray, Intersection &its, Sampler &rng) const override {
+        return occluded(primitiveIndex, ray, its, rng);
+    }
+
+    bool canBeHit(int primitiveIndex) const override {
+        return radius(primitiveIndex) > 0;
+    }
+
+    Bounds getBoundingBox(int primitiveIndex) const override {
+        const Vector extent(radius(primitiveIndex));
+        return Bounds(center(primitiveIndex) - extent, center(primitiveIndex) + extent);
+    }
+
+    Point getCentroid(int primitiveIndex) const override {
+        return center(primitiveIndex);
+    }
+
+public:
+    SphereCloud(const Properties &properties)
+    : AccelerationStructure(properties) {
+        m_originalPath = properties.get<std::filesystem::path>("filename");
+        // the radius of spheres that do not specify their own
+        m_radius = properties.get<float>("radius", 1);
+        if (m_originalPath.extension() == ".ply") {
+            readPLYPoints(m_originalPath, m_centers, m_radii, m_materials);
+        } else {
+            readRawSpheres(m_originalPath);
+        }
+
+        if (!m_radii.empty() && std::all_of(m_radii.begin(), m_radii.end(), [&](float r) { return r == m_radii[0]; })) {
+            // a single radius saves a quarter of the memory
+            m_radius = m_radii[0];
+            m_radii = {};
+        }
+        if (!m_materials.empty() && std::all_of(m_materials.begin(), m_materials.end(), [](uint16_t m) { return m == 0; })) {
+            m_materials = {};
+        }
+
+        sortSpheres();
+        logger(EInfo, "loaded %d spheres (%.2f MiB)", sphereCount(),
+            (sphereCount() * 3 * sizeof(float) + m_radii.size() * sizeof(float) +
+             m_materials.size() * sizeof(uint16_t)) / 1048576.0);
+        buildAccelerationStructure();
+    }
+
+    bool intersect(const Ray &ray, Intersection &its, Sampler &rng) const override {
+        PROFILE("Sphere cloud")
+        return intersectChildren(ray, its, rng);
+    }
+
+    bool occluded(const Ray &ray, Intersection &its, Sampler &rng) const override {
+        PROFILE("Sphere cloud")
+        return occludedChildren(ray, its, rng);
+    }
+
+    bool intersectChildren(const Ray &ray, Intersection &its, Sampler &rng) const override {
+        return intersectPrimitives<false>(ray, its, [&](int reference) {
+            return SphereCloud::intersect(referencedPrimitive(reference), ray, its, rng);
+        });
+    }
+
+    bool occludedChildren(const Ray &ray, Intersection &its, Sampler &rng) const override {
+        return intersectPrimitives<true>(ray, its, [&](int reference) {
+            return SphereCloud::occluded(referencedPrimitive(reference), ray, its, rng);
+        });
+    }
+
+    RayMask intersectPacket(const Ray *rays, Intersection *its, Sampler *const *rngs,
+                            RayMask active) const override {
+        return intersectLeavesPacket(rays, its, active, [&](int first, int count, RayMask leafRays) {
+            RayMask hits = 0;
+            for (int reference = first; reference < first + count; reference++) {
+                const int sphere = referencedPrimitive(reference);
+                for (RayMask remaining = leafRays; remaining; remaining &= remaining - 1) {
+                    const int index = std::countr_zero(remaining);
+                    if (SphereCloud::intersect(sphere, rays[index], its[index], *rngs[index])) {
+                        hits |= RayMask(1) << index;
+                    }
+                }
+            }
+            return hits;
+        });
+    }
+
+    void populateIntersection(Intersection &its) const override {
+        populate(its, its.primitiveIndex, decodeOctahedral(its.barycentrics));
+        its.materialIndex = m_materials.empty() ? 0 : m_materials[its.primitiveIndex];
+    }
+
+    std::string describe() const override {
+        return tfm::format("sphere cloud \"%s\"", m_originalPath.filename().string());
+    }
+
+    AreaSample sampleArea(Sampler &rng) const override {
+        int sphere = int(rng.next() * sphereCount());
+        sphere = std::min(sphere, sphereCount() - 1);
+
+        AreaSample sample;
+        populate(sample, sphere, squareToUniformSphere(rng.next2D()));
+        return sample;
+    }
+
+    std::string toString() const override {
+        return tfm::format(
+            "SphereCloud[\n"
+            "  spheres = %d,\n"
+            "  filename = \"%s\"\n"
+            "]",
+            sphereCount(),
+            m_originalPath.generic_string()
+        );
+    }
+};
+
+}
+
+REGISTER_SHAPE(SphereCloud, "sphereCloud")
@@ -0,0 +1,702 @@
+#pragma once
+
+#include <lightwave/core.hpp>
+#include <lightwave/math.hpp>
+#include <lightwave/shape.hpp>
+
+#include "bvh.hpp"
+#include "simd.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+namespace lightwave
+{
+
+    /// @brief The datatype used to index nodes and primitives of wide BVHs.
+    typedef int32_t WideNodeIndex;
+
+    /// @brief A node of a wide BVH with up to @c Width children, whose bounding
+    /// boxes are stored at full precision.
+    template <int Width>
+    struct alignas(64) WideNode
+    {
+        /**
+         * @brief The bounding boxes of all children, indexed by
+         * @code [side][axis][lane] @endcode , where side 0 refers to the
+         * minimum and side 1 to the maximum of the box. Unused lanes hold
+         * empty boxes, which can never be hit.
+         */
+        float bounds[2][3][Width];
+        /**
+         * @brief Either the index of the child node in the node list (for
+         * internal children), or the first primitive in the primitive index list
+         * of the binary BVH (for leaf children).
+         */
+        WideNodeIndex childFirst[Width];
+        /// @brief The number of primitives of a leaf child, or 0 for internal
+        /// children and unused lanes.
+        WideNodeIndex primitiveCount[Width];
+
+        /// @brief Stores the bounding boxes of all children.
+        void setBounds(const Bounds (&aabbs)[Width])
+        {
+            for (int lane = 0; lane < Width; lane++)
+            {
+                for (int dim = 0; dim < 3; dim++)
+                {
+                    bounds[0][dim][lane] = aabbs[lane].min()[dim];
+                    bounds[1][dim][lane] = aabbs[lane].max()[dim];
+                }
+            }
+        }
+
+        /// @brief Returns the bounding box of the child in the given lane.
+        Bounds getBounds(int lane) const
+        {
+            return Bounds(
+                Point(bounds[0][0][lane], bounds[0][1][lane], bounds[0][2][lane]),
+                Point(bounds[1][0][lane], bounds[1][1][lane], bounds[1][2][lane]));
+        }
+
+        /// @brief Returns a plane of the bounding box of a child.
+        float plane(int side, int dim, int lane) const { return bounds[side][dim][lane]; }
+#if defined(LW_BVH_SSE)
+        /// @brief Loads a plane of the bounding boxes of four children,
+        /// starting at the given lane.
+        __m128 planes4(int side, int dim, int lane) const
+        {
+            return _mm_load_ps(&bounds[side][dim][lane]);
+        }
+#endif
+#if defined(LW_BVH_AVX)
+        /// @brief Loads a plane of the bounding boxes of eight children.
+        __m256 planes8(int side, int dim) const
+        {
+            return _mm256_load_ps(bounds[side][dim]);
+        }
+#endif
+    };
+
+    /**
+     * @brief A node of a wide BVH with up to @c Width children, whose bounding
+     * boxes are quantized to 8 bits per plane relative to the bounding box of
+     * the node. This halves the size of a node (64 bytes for 4 children, 128
+     * bytes for 8 children).
+     * @note Quantization always rounds outwards, so the decoded boxes contain
+     * the original boxes and no intersection can be missed. Along axes where
+     * children reach infinity (e.g., unbounded shapes or instances whose
+     * transform overflows), the decoded planes range from the lowest float to
+     * infinity, so that they contain every finite point.
+     */
+    template <int Width>
+    struct alignas(64) QuantizedWideNode
+    {
+        /// @brief The minimum of the bounding box of the node, which
+        /// corresponds to the quantized value 0.
+        float origin[3];
+        /// @brief The size of one quantization step along each axis as power
+        /// of two.
+        int8_t exponent[3];
+        /**
+         * @brief The quantized bounding boxes of all children, indexed by
+         * @code [side][axis][lane] @endcode . Unused lanes have a minimum that
+         * is larger than their maximum, and can never be hit.
+         */
+        uint8_t quantized[2][3][Width];
+        /// @brief See @ref WideNode::childFirst .
+        WideNodeIndex childFirst[Width];
+        /// @brief See @ref WideNode::primitiveCount .
+        uint16_t primitiveCount[Width];
+
+        /// @brief The largest number of primitives a leaf child can have.
+        static constexpr int MaxPrimitiveCount = UINT16_MAX;
+
+        /// @brief Returns the size of one quantization step along the given axis.
+        float scale(int dim) const
+        {
+            // constructs 2^exponent directly from the bits of the float
+            return std::bit_cast<float>(uint32_t(exponent[dim] + 127) << 23);
+        }
+
+        /// @brief Decodes a quantized plane along the given axis.
+        float decode(int dim, uint8_t value) const
+        {
+            // the product is exact, hence this rounds the same way with and
+            // without fused multiply-add
+            return origin[dim] + float(value) * scale(dim);
+        }
+
+        /// @brief Quantizes all bounding boxes relative to their union,
+        /// rounding outwards.
+        void setBounds(const Bounds (&aabbs)[Width])
+        {
+            Bounds total = Bounds::empty();
+            for (int lane = 0; lane < Width; lane++)
+                total.extend(aabbs[lane]);
+
+            for (int dim = 0; dim < 3; dim++)
+            {
+                if (!(total.min()[dim] <= total.max()[dim]))
+                {
+                    // all lanes are unused
+                    origin[dim] = 0;
+                    exponent[dim] = 0;
+                }
+                else if (!std::isfinite(total.min()[dim]) || !std::isfinite(total.max()[dim]) ||
+                         !std::isfinite(total.max()[dim] - total.min()[dim]))
+                {
+                    // the extent cannot be covered by 255 finite steps, but
+                    // the largest steps from the lowest float decode to
+                    // planes up to infinity (and never to NaN)
+                    origin[dim] = std::numeric_limits<float>::lowest();
+                    exponent[dim] = 127;
+                }
+                else
+                {
+                    // the smallest step that covers the extent with 255 steps,
+                    // taking rounding of the decoded planes into account
+                    origin[dim] = total.min()[dim];
+                    const float extent = total.max()[dim] - total.min()[dim];
+                    int e = extent > 0 ? int(std::ceil(std::log2(extent / 255))) : -126;
+                    exponent[dim] = int8_t(std::clamp(e, -126, 127));
+                    while (exponent[dim] < 127 && decode(dim, 255) < total.max()[dim])
+                        exponent[dim]++;
+                }
+
+                for (int lane = 0; lane < Width; lane++)
+                {
+                    const Bounds &aabb = aabbs[lane];
+                    if (!(aabb.min()[dim] <= aabb.max()[dim]))
+                    {
+                        quantized[0][dim][lane] = 255;
+                        quantized[1][dim][lane] = 0;
+                        continue;
+                    }
+
+                    const float step = scale(dim);
+                    int lo = int(std::clamp(std::floor((aabb.min()[dim] - origin[dim]) / step), 0.f, 255.f));
+                    int hi = int(std::clamp(std::ceil((aabb.max()[dim] - origin[dim]) / step), 0.f, 255.f));
+                    // correct for the rounding of the division
+                    while (lo > 0 && decode(dim, uint8_t(lo)) > aabb.min()[dim])
+                        lo--;
+                    while (hi < 255 && decode(dim, uint8_t(hi)) < aabb.max()[dim])
+                        hi++;
+                    quantized[0][dim][lane] = uint8_t(lo);
+                    quantized[1][dim][lane] = uint8_t(hi);
+                }
+            }
+        }
+
+        /// @brief Returns a (conservative) plane of the bounding box of a child.
+        float plane(int side, int dim, int lane) const
+        {
+            return decode(dim, quantized[side][dim][lane]);
+        }
+#if defined(LW_BVH_SSE)
+        /// @brief Decodes a plane of the bounding boxes of four children,
+        /// starting at the given lane.
+        __m128 planes4(int side, int dim, int lane) const
+        {
+            // widen four bytes to 32 bit integers
+            uint32_t packed;
+            std::memcpy(&packed, &quantized[side][dim][lane], sizeof(packed));
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i values = _mm_unpacklo_epi16(
+                _mm_unpacklo_epi8(_mm_cvtsi32_si128(int(packed)), zero), zero);
+            return _mm_add_ps(_mm_set1_ps(origin[dim]),
+                              _mm_mul_ps(_mm_cvtepi32_ps(values), _mm_set1_ps(scale(dim))));
+        }
+#endif
+#if defined(LW_BVH_AVX)
+        /// @brief Decodes a plane of the bounding boxes of eight children.
+        __m256 planes8(int side, int dim) const
+        {
+            return _mm256_set_m128(planes4(side, dim, 4), planes4(side, dim, 0));
+        }
+#endif
+
+        /// @brief Returns the (conservative) bounding box of the child in the
+        /// given lane.
+        Bounds getBounds(int lane) const
+        {
+            Point min, max;
+            for (int dim = 0; dim < 3; dim++)
+            {
+                if (quantized[0][dim][lane] > quantized[1][dim][lane])
+                    return Bounds::empty(); // unused lane
+                min[dim] = decode(dim, quantized[0][dim][lane]);
+                max[dim] = decode(dim, quantized[1][dim][lane]);
+            }
+            return Bounds(min, max);
+        }
+    };
+    static_assert(sizeof(QuantizedWideNode<4>) == 64, "quantized BVH4 nodes must fill a cache line");
+
+    /**
+     * @brief A BVH with up to @c Width children per node, which is obtained by
+     * collapsing a binary BVH. The bounding boxes of all children of a node are
+     * stored in structure-of-arrays layout, so that they can be tested against a
+     * ray at once using SIMD instructions (SSE for BVH4, AVX for BVH8).
+     *
+     * Leaves of the binary BVH are not turned into separate nodes, but are
+     * referenced directly by the lanes of their parent, which saves one level of
+     * indirection per ray.
+     *
+     * @tparam Quantized Whether to store the bounding boxes of the children
+     * quantized (see @ref QuantizedWideNode ), which halves the memory of the
+     * nodes at the cost of decoding them during traversal and slightly looser
+     * boxes.
+     */
+    template <int Width, bool Quantized = false>
+    class WideBVH
+    {
+        static_assert(Width == 4 || Width == 8, "only BVH4 and BVH8 are supported");
+
+    public:
+        /// @brief The datatype used to index nodes and primitives.
+        typedef WideNodeIndex NodeIndex;
+
+        /// @brief A node with up to @c Width children.
+        typedef std::conditional_t<Quantized, QuantizedWideNode<Width>, WideNode<Width>> Node;
+
+    private:
+        /// @brief A list of all nodes, where the root node is the first element.
+        std::vector<Node, AlignedAllocator<Node, 64>> m_nodes;
+        /**
+         * @brief For every node: The kinds of rays that can hit each child
+         * (see @ref RayType ), or empty if all children can be hit by all rays.
+         */
+        std::vector<std::array<uint8_t, Width>> m_visibility;
+
+        /// @brief The maximum number of pending children during traversal
+        /// (every level of a tree with the given depth contributes at most
+        /// @c Width - 1 pending children).
+        static constexpr int maxStackSize(int maxDepth)
+        {
+            return maxDepth * (Width - 1) + 1;
+        }
+
+        /// @brief Returns the bounding box of all children of a node.
+        static Bounds totalBounds(const Node &node)
+        {
+            Bounds result = Bounds::empty();
+            for (int lane = 0; lane < Width; lane++)
+                result.extend(node.getBounds(lane));
+            return result;
+        }
+
+        /// @brief Computes the surface area of a bounding box.
+        static float surfaceArea(const Bounds &bounds)
+        {
+            const auto size = bounds.diagonal();
+            return 2 * (size.x() * size.y() + size.x() * size.z() +
+                        size.y() * size.z());
+        }
+
+        /**
+         * @brief Fills the wide node at @c wideIndex with the children that
+         * result from collapsing the binary subtree at @c binaryIndex , and
+         * recursively does the same for all internal children.
+         */
+        template <typename BinaryNodes>
+        void collapse(const BinaryNodes &binaryNodes, const std::vector<uint8_t> &binaryVisibility,
+                      NodeIndex binaryIndex, NodeIndex wideIndex)
+        {
+            // start with the children of the binary node, and keep replacing the
+            // internal child with the largest surface area by its two children
+            // until all lanes are filled (or only leaves are left).
+            NodeIndex children[Width];
+            int childCount = 0;
+            const auto &binaryNode = binaryNodes[binaryIndex];
+            if (binaryNode.isLeaf())
+            {
+                // can only happen for the root node
+                children[childCount++] = binaryIndex;
+            }
+            else
+            {
+                children[childCount++] = binaryNode.leftChildIndex();
+                children[childCount++] = binaryNode.rightChildIndex();
+            }
+
+            while (childCount < Width)
+            {
+                int bestChild = -1;
+                float bestArea = -1;
+                for (int i = 0; i < childCount; i++)
+                {
+                    const auto &child = binaryNodes[children[i]];
+                    if (child.isLeaf())
+                        continue;
+                    const float area = surfaceArea(child.aabb);
+                    if (area > bestArea)
+                    {
+                        bestChild = i;
+                        bestArea = area;
+                    }
+                }
+                if (bestChild < 0)
+                    break;
+
+                const auto &child = binaryNodes[children[bestChild]];
+                children[bestChild] = child.leftChildIndex();
+                children[childCount++] = child.rightChildIndex();
+            }
+
+            // first allocate all internal children, so that siblings end up next
+            // to each other in m_nodes
+            NodeIndex wideChildren[Width];
+            Bounds childBounds[Width];
+            for (int lane = 0; lane < Width; lane++)
+            {
+                Node &node = m_nodes[wideIndex];
+                if (lane >= childCount)
+                {
+                    childBounds[lane] = Bounds::empty();
+                    node.childFirst[lane] = -1;
+                    node.primitiveCount[lane] = 0;
+                    continue;
+                }
+
+                const auto &child = binaryNodes[children[lane]];
+                childBounds[lane] = child.aabb;
+                if (child.isLeaf())
+                {
+                    if constexpr (Quantized)
+                    {
+                        if (child.primitiveCount > Node::MaxPrimitiveCount)
+                            lightwave_throw("BVH leaf with %d primitives is too large for quantized nodes",
+                                            child.primitiveCount);
+                    }
+                    node.childFirst[lane] = child.firstPrimitiveIndex();
+                    node.primitiveCount[lane] = child.primitiveCount;
+                    wideChildren[lane] = -1;
+                }
+                else
+                {
+                    wideChildren[lane] = NodeIndex(m_nodes.size());
+                    // `node' breaks
+                    m_nodes.emplace_back();
+                    m_nodes[wideIndex].childFirst[lane] = wideChildren[lane];
+                    m_nodes[wideIndex].primitiveCount[lane] = 0;
+                }
+            }
+            m_nodes[wideIndex].setBounds(childBounds);
+
+            if (!binaryVisibility.empty())
+            {
+                m_visibility.resize(m_nodes.size());
+                for (int lane = 0; lane < Width; lane++)
+                    m_visibility[wideIndex][lane] = lane < childCount ? binaryVisibility[children[lane]] : 0;
+            }
+
+            for (int lane = 0; lane < childCount; lane++)
+            {
+                if (wideChildren[lane] >= 0)
+                    collapse(binaryNodes, binaryVisibility, children[lane], wideChildren[lane]);
+            }
+        }
+
+        /**
+         * @brief Tests all children of a node against a ray, and returns a
+         * bitmask of the lanes whose bounding box is hit before @c tMax .
+         * @param tNear Receives the distance at which the ray enters each box.
+         */
+        static int intersectChildren(const Node &node, const TraversalRay &ray,
+                                     float tMax, float *tNear)
+        {
+#if defined(LW_BVH_AVX)
+            if constexpr (Width == 8)
+            {
+                __m256 near = _mm256_set1_ps(-Infinity);
+                __m256 far = _mm256_set1_ps(Infinity);
+                for (int dim = 0; dim < 3; dim++)
+                {
+                    const int nearSide = ray.isNegative[dim];
+                    const __m256 origin = _mm256_set1_ps(ray.origin[dim]);
+                    const __m256 invDirection = _mm256_set1_ps(ray.invDirection[dim]);
+                    const __m256 t0 = _mm256_mul_ps(
+                        _mm256_sub_ps(node.planes8(nearSide, dim), origin),
+                        invDirection);
+                    const __m256 t1 = _mm256_mul_ps(
+                        _mm256_sub_ps(node.planes8(1 - nearSide, dim), origin),
+                        invDirection);
+                    // the accumulator is passed last so that NaNs (from rays
+                    // parallel to a slab) are ignored, as in the scalar test
+                    near = _mm256_max_ps(t0, near);
+                    far = _mm256_min_ps(t1, far);
+                }
+                _mm256_store_ps(tNear, near);
+                const __m256 hit = _mm256_and_ps(
+                    _mm256_and_ps(_mm256_cmp_ps(near, far, _CMP_LE_OQ),
+                                  _mm256_cmp_ps(far, _mm256_set1_ps(Epsilon), _CMP_GE_OQ)),
+                    _mm256_cmp_ps(near, _mm256_set1_ps(tMax), _CMP_LT_OQ));
+                return _mm256_movemask_ps(hit);
+            }
+#endif
+#if defined(LW_BVH_SSE)
+            if constexpr (Width == 4)
+            {
+                __m128 near = _mm_set1_ps(-Infinity);
+                __m128 far = _mm_set1_ps(Infinity);
+                for (int dim = 0; dim < 3; dim++)
+                {
+                    const int nearSide = ray.isNegative[dim];
+                    const __m128 origin = _mm_set1_ps(ray.origin[dim]);
+                    const __m128 invDirection = _mm_set1_ps(ray.invDirection[dim]);
+                    const __m128 t0 = _mm_mul_ps(
+                        _mm_sub_ps(node.planes4(nearSide, dim, 0), origin),
+                        invDirection);
+                    const __m128 t1 = _mm_mul_ps(
+                        _mm_sub_ps(node.planes4(1 - nearSide, dim, 0), origin),
+                        invDirection);
+                    // the accumulator is passed last so that NaNs (from rays
+                    // parallel to a slab) are ignored, as in the scalar test
+                    near = _mm_max_ps(t0, near);
+                    far = _mm_min_ps(t1, far);
+                }
+                _mm_store_ps(tNear, near);
+                const __m128 hit = _mm_and_ps(
+                    _mm_and_ps(_mm_cmple_ps(near, far),
+                               _mm_cmpge_ps(far, _mm_set1_ps(Epsilon))),
+                    _mm_cmplt_ps(near, _mm_set1_ps(tMax)));
+                return _mm_movemask_ps(hit);
+            }
+#endif
+            // portable fallback (e.g., BVH8 on machines without AVX)
+            int mask = 0;
+            for (int lane = 0; lane < Width; lane++)
+            {
+                float near = -Infinity;
+                float far = Infinity;
+                for (int dim = 0; dim < 3; dim++)
+                {
+                    const int nearSide = ray.isNegative[dim];
+                    near = std::max(near, (node.plane(nearSide, dim, lane) - ray.origin[dim]) *
+                                              ray.invDirection[dim]);
+                    far = std::min(far, (node.plane(1 - nearSide, dim, lane) - ray.origin[dim]) *
+                                            ray.invDirection[dim]);
+                }
+                tNear[lane] = near;
+                if (near <= far && far >= Epsilon && near < tMax)
+                    mask |= 1 << lane;
+            }
+            return mask;
+        }
+
+    public:
+        /// @brief Whether this BVH has been built.
+        bool isEmpty() const { return m_nodes.empty(); }
+
+        /// @brief The number of nodes of this BVH.
+        size_t nodeCount() const { return m_nodes.size(); }
+
+        /// @brief The memory occupied by the nodes of this BVH in bytes.
+        size_t memoryUsage() const
+        {
+            return m_nodes.size() * sizeof(Node) + m_visibility.size() * Width;
+        }
+
+        /// @brief Removes all nodes.
+        void clear()
+        {
+            m_nodes.clear();
+            m_nodes.shrink_to_fit();
+            m_visibility.clear();
+            m_visibility.shrink_to_fit();
+        }
+
+        /**
+         * @brief Builds the wide BVH by collapsing a binary BVH, whose root node
+         * is the first element of @c binaryNodes .
+         * @note The binary nodes need to provide @c aabb , @c isLeaf() ,
+         * @c leftChildIndex() , @c rightChildIndex() , @c firstPrimitiveIndex()
+         * and @c primitiveCount .
+         * @param binaryVisibility The kinds of rays that can hit each binary
+         * node, or empty if all nodes can be hit by all rays.
+         */
+        template <typename BinaryNodes>
+        void build(const BinaryNodes &binaryNodes, const std::vector<uint8_t> &binaryVisibility = {})
+        {
+            m_nodes.clear();
+            m_visibility.clear();
+            m_nodes.emplace_back();
+            collapse(binaryNodes, binaryVisibility, 0, 0);
+            m_nodes.shrink_to_fit();
+            m_visibility.shrink_to_fit();
+        }
+
+        /**
+         * @brief Recomputes the bounding boxes of all children bottom-up, keeping
+         * the topology of the tree intact.
+         * @param leafBounds Called as @code leafBounds(first, count) @endcode for
+         * every leaf child, and returns the bounding box of its primitives.
+         * @return The bounding box of the entire BVH.
+         */
+        template <typename LeafBounds>
+        Bounds refit(LeafBounds &&leafBounds)
+        {
+            // children are always allocated after their parent, hence iterating
+            // backwards visits children before their parents
+            for (NodeIndex nodeIndex = NodeIndex(m_nodes.size()) - 1; nodeIndex >= 0; nodeIndex--)
+            {
+                Node &node = m_nodes[nodeIndex];
+                Bounds childBounds[Width];
+                for (int lane = 0; lane < Width; lane++)
+                {
+                    if (node.primitiveCount[lane] > 0)
+                        childBounds[lane] = leafBounds(node.childFirst[lane],
+                                                       node.primitiveCount[lane]);
+                    else if (node.childFirst[lane] >= 0)
+                        childBounds[lane] = totalBounds(m_nodes[node.childFirst[lane]]);
+                    else
+                        childBounds[lane] = Bounds::empty();
+                }
+                node.setBounds(childBounds);
+            }
+            return totalBounds(m_nodes.front());
+        }
+
+        /**
+         * @brief Visits every node and leaf of the tree (e.g., to gather
+         * statistics about it).
+         * @param visitNode Called as @code visitNode(childBounds, childCount) @endcode
+         * for every node, with the bounding boxes of its non-empty lanes.
+         * @param visitLeaf Called as @code visitLeaf(bounds, count, depth) @endcode
+         * for every leaf child, where @c depth is the number of nodes above it.
+         */
+        template <typename VisitNode, typename VisitLeaf>
+        void visit(VisitNode &&visitNode, VisitLeaf &&visitLeaf) const
+        {
+            std::vector<std::pair<NodeIndex, int>> stack = {{0, 0}};
+            while (!stack.empty())
+            {
+                const auto [nodeIndex, depth] = stack.back();
+                stack.pop_back();
+                const Node &node = m_nodes[nodeIndex];
+
+                Bounds childBounds[Width];
+                int childCount = 0;
+                for (int lane = 0; lane < Width; lane++)
+                {
+                    if (node.primitiveCount[lane] > 0)
+                        visitLeaf(node.getBounds(lane), int(node.primitiveCount[lane]), depth + 1);
+                    else if (node.childFirst[lane] >= 0)
+                        stack.emplace_back(node.childFirst[lane], depth + 1);
+                    else
+                        continue;
+                    childBounds[childCount++] = node.getBounds(lane);
+                }
+                visitNode(childBounds, childCount);
+            }
+        }
+
+        /**
+         * @brief Traverses the BVH, visiting children in the order in which they
+         * are hit by the ray.
+         * @tparam MaxDepth The maximum depth of the binary BVH this tree was
+         * collapsed from, which bounds the size of the traversal stack.
+         * @tparam AnyHit Whether to stop at the first leaf that reports a hit
+         * (children are then visited in arbitrary order).
+         * @param intersectLeaf Called as @code intersectLeaf(first, count) @endcode
+         * for every leaf that might contain a closer hit, and returns whether a
+         * hit has been found (updating @c its.t ).
+         * @note The root node itself is not tested, the caller is expected to
+         * test the bounding box of the entire BVH first.
+         */
+        template <int MaxDepth, bool AnyHit, typename IntersectLeaf>
+        bool traverse(const TraversalRay &ray, Intersection &its,
+                      IntersectLeaf &&intersectLeaf) const
+        {
+            struct StackEntry
+            {
+                NodeIndex childFirst;
+                NodeIndex primitiveCount;
+                float t;
+            };
+            StackEntry stack[maxStackSize(MaxDepth)];
+            int stackSize = 0;
+            stack[stackSize++] = {0, 0, -Infinity};
+
+            bool wasIntersected = false;
+            while (stackSize > 0)
+            {
+                const StackEntry entry = stack[--stackSize];
+                // skip children that can no longer contain a closer intersection
+                if (!(entry.t < its.t))
+                    continue;
+
+                // update the statistic tracking how many BVH nodes have been
+                // tested for intersection
+                its.stats.bvhCounter++;
+
+                if (entry.primitiveCount > 0)
+                {
+                    if (intersectLeaf(entry.childFirst, entry.primitiveCount))
+                    {
+                        if constexpr (AnyHit)
+                            return true;
+                        wasIntersected = true;
+                    }
+                    continue;
+                }
+
+                const Node &node = m_nodes[entry.childFirst];
+                alignas(32) float tNear[Width];
+                int mask = intersectChildren(node, ray, its.t, tNear);
+                if (!m_visibility.empty())
+                {
+                    // skip children that the ray cannot hit
+                    const auto &visibility = m_visibility[entry.childFirst];
+                    for (int lane = 0; lane < Width; lane++)
+                    {
+                        if (!(visibility[lane] & its.rayType))
+                            mask &= ~(1 << lane);
+                    }
+                }
+
+                if constexpr (AnyHit)
+                {
+                    while (mask)
+                    {
+                        const int lane = std::countr_zero(unsigned(mask));
+                        mask &= mask - 1;
+                        stack[stackSize++] = {node.childFirst[lane],
+                                              node.primitiveCount[lane], tNear[lane]};
+                    }
+                    continue;
+                }
+
+                // sort the children that have been hit by descending distance,
+                // so that the closest child ends up on top of the stack
+                int hitLanes[Width];
+                int hitCount = 0;
+                while (mask)
+                {
+                    const int lane = std::countr_zero(unsigned(mask));
+                    mask &= mask - 1;
+
+                    int i = hitCount++;
+                    for (; i > 0 && tNear[hitLanes[i - 1]] < tNear[lane]; i--)
+                        hitLanes[i] = hitLanes[i - 1];
+                    hitLanes[i] = lane;
+                }
+
+                for (int i = 0; i < hitCount; i++)
+                {
+                    const int lane = hitLanes[i];
+                    stack[stackSize++] = {node.childFirst[lane],
+                                          node.primitiveCount[lane], tNear[lane]};
+                }
+            }
+            return wasIntersected;
+        }
+    };
+
+} // namespace lightwave
@@ -23,6 +23,9 @@ class CompareImage : public Test {
     float m_thresholdME;
     /// @brief Whether to report an error if any color channels in the output image are negative.
     bool m_allowNegative;
+    /// @brief The frame of an animated scene to render, after stepping through all previous frames (see
+    /// @ref Scene::setFrame ).
+    int m_frame;
 
 public:
     CompareImage(const Properties &properties) {
@@ -31,6 +34,7 @@ public:
         m_thresholdME = properties.get<float>("me", 2e-4);
         m_basePath = properties.basePath(); // we store the test image in the same folder as the scene file
         m_allowNegative = properties.get<bool>("allowNegative", true);
+        m_frame = properties.get<int>("frame", 0);
     }
 
     void execute() override {
@@ -40,6 +44,10 @@ public:
         image->setBasePath(m_basePath);
         image->setId(id() + "_test");
         m_integrator->setImage(image);
+        // frames are applied one after another like in a sequence, so that every change is updated incrementally
+        for (int frame = 0; frame <= m_frame; frame++) {
+            m_integrator->scene()->setFrame(frame);
+        }
         m_integrator->execute();
 
         if (std::getenv("reference")) {
@@ -0,0 +1,300 @@
+#include <lightwave.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+namespace lightwave {
+
+/**
+ * @brief Tests whether a JSON report written by an executable (e.g., the statistics of the BVH inspector) matches a
+ * given reference report.
+ *
+ * The executable must write its report to @c <id>_test.json next to the test file, which is then parsed (hence a
+ * report that is not valid JSON fails the test) and compared against @c <id>_ref.json . Objects are compared member by
+ * member, where the optional @c keys property limits which members of nested objects are compared (e.g., to ignore
+ * statistics that depend on details of the BVH builders). Numbers are compared with a relative tolerance, and null
+ * values only match null values.
+ */
+class CompareReport : public Test {
+    /// @brief A parsed JSON value.
+    struct Json {
+        enum class Type { Null, Boolean, Number, String, Array, Object };
+        Type type = Type::Null;
+        double number = 0;
+        std::string string;
+        std::vector<Json> elements;
+        /// @brief The members of an object, in the order they appear in the file.
+        std::vector<std::pair<std::string, Json>> members;
+    };
+
+    /// @brief A minimal recursive descent parser, which reports malformed JSON as exception.
+    class JsonParser {
+        const std::string &m_text;
+        size_t m_position = 0;
+
+        void skipWhitespace() {
+            while (m_position < m_text.size() && std::isspace((unsigned char)m_text[m_position])) {
+                m_position++;
+            }
+        }
+
+        char peek() {
+            skipWhitespace();
+            if (m_position >= m_text.size()) {
+                lightwave_throw("unexpected end of JSON");
+            }
+            return m_text[m_position];
+        }
+
+        void expect(char c) {
+            if (peek() != c) {
+                lightwave_throw("expected '%c' at offset %d of JSON, found '%c'", c, m_position, m_text[m_position]);
+            }
+            m_position++;
+        }
+
+        bool consume(const char *literal) {
+            const size_t length = std::strlen(literal);
+            if (m_text.compare(m_position, length, literal) != 0) {
+                return false;
+            }
+            m_position += length;
+            return true;
+        }
+
+        std::string parseString() {
+            expect('"');
+            std::string result;
+            while (true) {
+                if (m_position >= m_text.size()) {
+                    lightwave_throw("unterminated string in JSON");
+                }
+                const char c = m_text[m_position++];
+                if (c == '"') {
+                    return result;
+                }
+                if ((unsigned char)c < 0x20) {
+                    lightwave_throw("control character within string at offset %d of JSON", m_position - 1);
+                }
+                if (c != '\\') {
+                    result += c;
+                    continue;
+                }
+                if (m_position >= m_text.size()) {
+                    lightwave_throw("unterminated string in JSON");
+                }
+                switch (const char escaped = m_text[m_position++]) {
+                case '"': case '\\': case '/': result += escaped; break;
+                case 'b': result += '\b'; break;
+                case 'f': result += '\f'; break;
+                case 'n': result += '\n'; break;
+                case 'r': result += '\r'; break;
+                case 't': result += '\t'; break;
+                case 'u': {
+                    // only needed for control characters, hence code points beyond ASCII are not decoded
+                    if (m_position + 4 > m_text.size()) {
+                        lightwave_throw("unterminated escape sequence in JSON");
+                    }
+                    const int code = std::stoi(m_text.substr(m_position, 4), nullptr, 16);
+                    m_position += 4;
+                    result += code < 0x80 ? char(code) : '?';
+                    break;
+                }
+                default:
+                    lightwave_throw("invalid escape sequence '\\%c' in JSON", escaped);
+                }
+            }
+        }
+
+        Json parseValue() {
+            Json result;
+            const char c = peek();
+            if (c == '{') {
+                result.type = Json::Type::Object;
+                m_position++;
+                if (peek() == '}') {
+                    m_position++;
+                    return result;
+                }
+                while (true) {
+                    std::string key = parseString();
+                    expect(':');
+                    result.members.emplace_back(std::move(key), parseValue());
+                    if (peek() != ',') {
+                        break;
+                    }
+                    m_position++;
+                }
+                expect('}');
+            } else if (c == '[') {
+                result.type = Json::Type::Array;
+                m_position++;
+                if (peek() == ']') {
+                    m_position++;
+                    return result;
+                }
+                while (true) {
+                    result.elements.push_back(parseValue());
+                    if (peek() != ',') {
+                        break;
+                    }
+                    m_position++;
+                }
+                expect(']');
+            } else if (c == '"') {
+                result.type = Json::Type::String;
+                result.string = parseString();
+            } else if (consume("null")) {
+                result.type = Json::Type::Null;
+            } else if (consume("true")) {
+                result.type = Json::Type::Boolean;
+                result.number = 1;
+            } else if (consume("false")) {
+                result.type = Json::Type::Boolean;
+                result.number = 0;
+            } else {
+                // strtod also accepts infinities and NaNs, which are not valid JSON
+                const size_t digit = c == '-' ? m_position + 1 : m_position;
+                if (digit >= m_text.size() || !std::isdigit((unsigned char)m_text[digit])) {
+                    lightwave_throw("unexpected '%c' at offset %d of JSON", c, m_position);
+                }
+                char *end;
+                result.type = Json::Type::Number;
+                result.number = std::strtod(m_text.c_str() + m_position, &end);
+                m_position = end - m_text.c_str();
+            }
+            return result;
+        }
+
+    public:
+        JsonParser(const std::string &text) : m_text(text) {}
+
+        Json parse() {
+            Json result = parseValue();
+            skipWhitespace();
+            if (m_position != m_text.size()) {
+                lightwave_throw("unexpected trailing characters at offset %d of JSON", m_position);
+            }
+            return result;
+        }
+    };
+
+    /// @brief The executable that writes the report.
+    ref<Executable> m_executable;
+    /// @brief The directory the report is stored in.
+    std::filesystem::path m_basePath;
+    /// @brief The members of nested objects to compare (empty to compare all members).
+    std::vector<std::string> m_keys;
+    /// @brief The relative tolerance for numbers.
+    double m_tolerance;
+
+    static Json load(const std::filesystem::path &path) {
+        std::ifstream file(path);
+        if (!file) {
+            lightwave_throw("could not read report \"%s\"", path.generic_string());
+        }
+        std::stringstream text;
+        text << file.rdbuf();
+        try {
+            return JsonParser(text.str()).parse();
+        } catch (const std::exception &e) {
+            lightwave_throw("report \"%s\" is not valid JSON: %s", path.generic_string(), e.what());
+        }
+    }
+
+    static const char *typeName(Json::Type type) {
+        switch (type) {
+        case Json::Type::Null: return "null";
+        case Json::Type::Boolean: return "a boolean";
+        case Json::Type::Number: return "a number";
+        case Json::Type::String: return "a string";
+        case Json::Type::Array: return "an array";
+        default: return "an object";
+        }
+    }
+
+    void compare(const Json &value, const Json &reference, const std::string &path, int depth) const {
+        if (value.type != reference.type) {
+            lightwave_throw("%s is %s, but %s in the reference", path, typeName(value.type),
+                typeName(reference.type));
+        }
+        switch (reference.type) {
+        case Json::Type::Null:
+            break;
+        case Json::Type::Boolean:
+        case Json::Type::Number:
+            if (std::abs(value.number - reference.number) > m_tolerance * std::abs(reference.number)) {
+                lightwave_throw("%s is %g, but %g in the reference", path, value.number, reference.number);
+            }
+            break;
+        case Json::Type::String:
+            if (value.string != reference.string) {
+                lightwave_throw("%s is \"%s\", but \"%s\" in the reference", path, value.string, reference.string);
+            }
+            break;
+        case Json::Type::Array:
+            if (value.elements.size() != reference.elements.size()) {
+                lightwave_throw("%s has %d elements, but %d in the reference", path, value.elements.size(),
+                    reference.elements.size());
+            }
+            for (size_t index = 0; index < reference.elements.size(); index++) {
+                compare(value.elements[index], reference.elements[index], tfm::format("%s[%d]", path, index),
+                    depth + 1);
+            }
+            break;
+        case Json::Type::Object:
+            for (const auto &[key, member] : reference.members) {
+                // the root object is always compared in full
+                if (depth > 0 && !m_keys.empty() && std::find(m_keys.begin(), m_keys.end(), key) == m_keys.end()) {
+                    continue;
+                }
+                const auto it = std::find_if(value.members.begin(), value.members.end(),
+                    [&](const auto &candidate) { return candidate.first == key; });
+                if (it == value.members.end()) {
+                    lightwave_throw("%s.%s is missing", path, key);
+                }
+                compare(it->second, member, path + "." + key, depth + 1);
+            }
+            break;
+        }
+    }
+
+public:
+    CompareReport(const Properties &properties) {
+        m_executable = properties.getChild<Executable>();
+        m_basePath = properties.basePath(); // the report is stored in the same folder as the scene file
+        m_tolerance = properties.get<float>("tolerance", 1e-4);
+
+        std::stringstream keys(properties.get<std::string>("keys", ""));
+        for (std::string key; std::getline(keys, key, ',');) {
+            m_keys.push_back(key);
+        }
+    }
+
+    void execute() override {
+        const std::filesystem::path testPath = m_basePath / (id() + "_test.json");
+        const std::filesystem::path referencePath = m_basePath / (id() + "_ref.json");
+
+        std::filesystem::remove(testPath);
+        m_executable->execute();
+        const Json report = load(testPath);
+
+        if (std::getenv("reference")) {
+            std::filesystem::copy_file(testPath, referencePath, std::filesystem::copy_options::overwrite_existing);
+        } else {
+            compare(report, load(referencePath), "report", 0);
+            logger(EInfo, "test passed!");
+        }
+    }
+
+    std::string toString() const override {
+        return "CompareReport[]";
+    }
+};
+
+}
+
+REGISTER_TEST(CompareReport, "report");
@@ -29,6 +29,13 @@ public:
         return ((int)my_uv.x() % 2) + ((int)my_uv.y() % 2) != 1 ? color0 : color1;
     }
 
+    bool redRange(const Point2 &a, const Point2 &b, const Point2 &c, float &min, float &max) const override {
+        // conservatively assume that both colors occur
+        min = std::min(color0.r(), color1.r());
+        max = std::max(color0.r(), color1.r());
+        return true;
+    }
+
     std::string toString() const override {
         return tfm::format("CheckerboardsTexture[\n"
                            "  value = %s\n"
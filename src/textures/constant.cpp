@@ -12,6 +12,11 @@ public:
 
     Color evaluate(const Point2 &uv) const override { return m_value; }
 
+    bool redRange(const Point2 &a, const Point2 &b, const Point2 &c, float &min, float &max) const override {
+        min = max = m_value.r();
+        return true;
+    }
+
     std::string toString() const override {
         return tfm::format("ConstantTexture[\n"
                            "  value = %s\n"
@@ -128,6 +128,54 @@ namespace lightwave
             }
         }
 
+        bool redRange(const Point2 &a, const Point2 &b, const Point2 &c, float &min, float &max) const override
+        {
+            const int width = m_image->resolution().x();
+            const int height = m_image->resolution().y();
+
+            // the triangle in pixel coordinates as used by the bilinear lookup (with the y-axis inverted)
+            const Point2 corners[3] = {a, b, c};
+            Point2 triangle[3];
+            for (int i = 0; i < 3; i++)
+            {
+                triangle[i] = Point2(corners[i].x() * width - 0.5f, (1 - corners[i].y()) * height - 0.5f);
+            }
+
+            // every lookup reads from the pixels around it (bilinear), or the pixel closest to it (nearest), hence a
+            // pixel can only influence lookups within one pixel of its center
+            const float lowerX = std::floor(std::min({triangle[0].x(), triangle[1].x(), triangle[2].x()}));
+            const float lowerY = std::floor(std::min({triangle[0].y(), triangle[1].y(), triangle[2].y()}));
+            const float upperX = std::floor(std::max({triangle[0].x(), triangle[1].x(), triangle[2].x()})) + 1;
+            const float upperY = std::floor(std::max({triangle[0].y(), triangle[1].y(), triangle[2].y()})) + 1;
+            // written so that NaNs and huge coordinates are rejected
+            if (!(std::abs(lowerX) < MaxCoordinate && std::abs(lowerY) < MaxCoordinate &&
+                  std::abs(upperX) < MaxCoordinate && std::abs(upperY) < MaxCoordinate &&
+                  (upperX - lowerX + 1) * (upperY - lowerY + 1) <= MaxRasterizedPixels))
+            {
+                // the triangle covers (or repeats) too much of the image to be worth rasterizing
+                return false;
+            }
+
+            min = +Infinity;
+            max = -Infinity;
+            for (int y = int(lowerY); y <= int(upperY); y++)
+            {
+                for (int x = int(lowerX); x <= int(upperX); x++)
+                {
+                    if (!overlapsSquare(triangle, Point2(float(x), float(y))))
+                        continue;
+
+                    Point2i pixel = Point2i(x, y);
+                    pixel = m_border == BorderMode::Clamp ? clamp_point(pixel, width, height)
+                                                          : repeat_point(pixel, width, height);
+                    const float value = m_exposure * m_image->operator()(pixel).r();
+                    min = std::min(min, value);
+                    max = std::max(max, value);
+                }
+            }
+            return min <= max;
+        }
+
         std::string toString() const override
         {
             return tfm::format("ImageTexture[\n"
@@ -139,6 +187,42 @@ namespace lightwave
 
         // Helper functions
     private:
+        /// @brief The largest number of pixels that @ref redRange considers for a single triangle.
+        static constexpr float MaxRasterizedPixels = 1 << 20;
+        /// @brief The largest pixel coordinate that @ref redRange considers (to stay clear of integer overflows).
+        static constexpr float MaxCoordinate = 1 << 24;
+
+        /**
+         * @brief Tests whether a triangle (in pixel coordinates) overlaps the square of side length two around the
+         * given pixel center (separating axis test).
+         */
+        static bool overlapsSquare(const Point2 (&triangle)[3], const Point2 &center)
+        {
+            for (int dim = 0; dim < 2; dim++)
+            {
+                const float lower = std::min({triangle[0][dim], triangle[1][dim], triangle[2][dim]});
+                const float upper = std::max({triangle[0][dim], triangle[1][dim], triangle[2][dim]});
+                if (lower > center[dim] + 1 || upper < center[dim] - 1)
+                    return false;
+            }
+
+            for (int edge = 0; edge < 3; edge++)
+            {
+                const Point2 &from = triangle[edge];
+                const Point2 &to = triangle[(edge + 1) % 3];
+                const Point2 &opposite = triangle[(edge + 2) % 3];
+                const Vector2 normal(from.y() - to.y(), to.x() - from.x());
+
+                // the square lies outside if it is entirely on the other side of the edge than the opposite vertex
+                const float side = normal.dot(opposite - from);
+                const float distance = normal.dot(center - from);
+                const float radius = std::abs(normal.x()) + std::abs(normal.y());
+                if (side > 0 ? distance < -radius : side < 0 && distance > radius)
+                    return false;
+            }
+            return true;
+        }
+
         Point2i clamp_point(Point2i p, int width, int height) const
         {
             // clamps our point between [0;width] and [0;height]
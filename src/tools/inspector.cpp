@@ -0,0 +1,185 @@
+#include <lightwave.hpp>
+
+#include "../shapes/accel.hpp"
+
+#include <cmath>
+#include <fstream>
+#include <unordered_set>
+
+namespace lightwave {
+
+/**
+ * @brief Reports the quality of every acceleration structure in a scene (i.e., every mesh and group), to compare BVH
+ * builders and layouts without relying on render times alone.
+ * For each structure, the SAH cost, the depth and leaf sizes and the overlap of siblings are reported, as well as the
+ * number of nodes and primitives that a grid of camera rays tests on average (excluding the work done in nested
+ * structures). The report is logged, and optionally written to a JSON file.
+ */
+class BvhInspector : public Executable {
+    /// @brief The scene whose acceleration structures are inspected.
+    ref<Scene> m_scene;
+    /// @brief The random number generator used to sample camera rays.
+    ref<Sampler> m_sampler;
+    /// @brief The (approximate) number of camera rays to trace, which are spread over the image in a regular grid.
+    int m_rayCount;
+    /// @brief The file the JSON report is written to (empty if no JSON report is requested).
+    std::filesystem::path m_jsonPath;
+
+    /// @brief Collects all acceleration structures within a shape, each one only once (even if it is instanced).
+    static void collect(const Shape &shape, std::vector<const AccelerationStructure *> &structures,
+                        std::unordered_set<const Shape *> &visited) {
+        if (!visited.insert(&shape).second) {
+            return;
+        }
+        if (const auto structure = dynamic_cast<const AccelerationStructure *>(&shape)) {
+            structures.push_back(structure);
+        }
+        shape.forEachChild([&](const Shape &child) { collect(child, structures, visited); });
+    }
+
+    /// @brief Traces the grid of camera rays, and returns the number of rays that have been traced.
+    int traceCameraRays() const {
+        const Vector2i resolution = m_scene->camera()->resolution();
+        const float aspect = float(resolution.x()) / resolution.y();
+        const int columns = std::max(1, int(std::round(std::sqrt(m_rayCount * aspect))));
+        const int rows = std::max(1, int(std::round(float(m_rayCount) / columns)));
+
+        auto rng = m_sampler->clone();
+        for (int y = 0; y < rows; y++) {
+            for (int x = 0; x < columns; x++) {
+                rng->seed(Point2i(x, y), 0);
+                const Point2 normalized {
+                    2 * (x + 0.5f) / columns - 1,
+                    2 * (y + 0.5f) / rows - 1
+                };
+                const CameraSample cameraSample = m_scene->camera()->sample(normalized, *rng);
+                m_scene->intersect(cameraSample.ray, *rng);
+            }
+        }
+        return columns * rows;
+    }
+
+    /// @brief Escapes a string for use in JSON.
+    static std::string escape(const std::string &string) {
+        std::string result;
+        for (const char c : string) {
+            if (c == '"' || c == '\\') {
+                result += '\\';
+                result += c;
+            } else if ((unsigned char)c < 0x20) {
+                // control characters (e.g., line breaks of descriptions) are not allowed within JSON strings
+                result += tfm::format("\\u%04x", int(c));
+            } else {
+                result += c;
+            }
+        }
+        return result;
+    }
+
+    /// @brief Formats a number for use in JSON, which has no representation for infinities and NaNs.
+    static std::string number(float value) {
+        return std::isfinite(value) ? tfm::format("%g", value) : "null";
+    }
+
+public:
+    BvhInspector(const Properties &properties) {
+        m_scene = properties.getChild<Scene>();
+        m_sampler = properties.getChild<Sampler>();
+        m_rayCount = properties.get<int>("rays", 4096);
+        if (properties.has("json")) {
+            m_jsonPath = properties.get<std::filesystem::path>("json");
+        }
+    }
+
+    void execute() override {
+        std::vector<const AccelerationStructure *> structures;
+        std::unordered_set<const Shape *> visited;
+        collect(*m_scene->shape(), structures, visited);
+
+        TraversalRecorder recorder;
+        const int rayCount = traceCameraRays();
+
+        std::stringstream json;
+        json << "{\n  \"rays\": " << rayCount << ",\n  \"structures\": [";
+        for (size_t index = 0; index < structures.size(); index++) {
+            const AccelerationStructure *structure = structures[index];
+            const BvhStatistics stats = structure->statistics();
+            const TraversalCounts counts = recorder.counts(structure);
+            const std::string name = structure->id().empty()
+                ? structure->describe()
+                : tfm::format("%s (%s)", structure->describe(), structure->id());
+
+            // averages over the camera rays, including the rays that never reach this structure
+            const float nodesPerRay = float(counts.nodes) / rayCount;
+            const float primitivesPerRay = float(counts.primitives) / rayCount;
+
+            std::stringstream histogram;
+            for (size_t size = 0; size < stats.leafSizes.size(); size++) {
+                if (stats.leafSizes[size] > 0) {
+                    histogram << (histogram.tellp() > 0 ? ", " : "") << size << ": " << stats.leafSizes[size];
+                }
+            }
+
+            logger(EInfo,
+                "%s\n"
+                "  nodes: %d internal, %d leaves, %d references\n"
+                "  SAH cost: %.2f, sibling overlap: %.3f\n"
+                "  depth: %d max, %.1f average\n"
+                "  leaf sizes: %s\n"
+                "  per camera ray: %.2f nodes, %.2f primitives (%d traversals)",
+                name,
+                stats.internalNodes, stats.leaves, stats.references,
+                stats.sahCost, stats.siblingOverlap,
+                stats.maxDepth, stats.averageDepth,
+                histogram.str(),
+                nodesPerRay, primitivesPerRay, counts.traversals
+            );
+
+            json << (index > 0 ? "," : "") << "\n    {\n"
+                 << "      \"name\": \"" << escape(name) << "\",\n"
+                 << "      \"internalNodes\": " << stats.internalNodes << ",\n"
+                 << "      \"leaves\": " << stats.leaves << ",\n"
+                 << "      \"references\": " << stats.references << ",\n"
+                 << "      \"sahCost\": " << number(stats.sahCost) << ",\n"
+                 << "      \"siblingOverlap\": " << number(stats.siblingOverlap) << ",\n"
+                 << "      \"maxDepth\": " << stats.maxDepth << ",\n"
+                 << "      \"averageDepth\": " << number(stats.averageDepth) << ",\n"
+                 << "      \"leafSizes\": [";
+            for (size_t size = 0; size < stats.leafSizes.size(); size++) {
+                json << (size > 0 ? ", " : "") << stats.leafSizes[size];
+            }
+            json << "],\n"
+                 << "      \"traversals\": " << counts.traversals << ",\n"
+                 << "      \"nodesPerRay\": " << number(nodesPerRay) << ",\n"
+                 << "      \"primitivesPerRay\": " << number(primitivesPerRay) << "\n"
+                 << "    }";
+        }
+        json << "\n  ]\n}\n";
+
+        if (!m_jsonPath.empty()) {
+            std::ofstream file(m_jsonPath);
+            if (!file) {
+                lightwave_throw("could not write BVH report \"%s\"", m_jsonPath.generic_string());
+            }
+            file << json.str();
+            logger(EInfo, "saved BVH report %s", m_jsonPath);
+        }
+    }
+
+    std::string toString() const override {
+        return tfm::format(
+            "BvhInspector[\n"
+            "  scene = %s,\n"
+            "  sampler = %s,\n"
+            "  rays = %d\n"
+            "]",
+            indent(m_scene),
+            indent(m_sampler),
+            m_rayCount
+        );
+    }
+};
+
+}
+
+REGISTER_CLASS(BvhInspector, "inspect", "default")